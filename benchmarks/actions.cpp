@@ -0,0 +1,90 @@
+/*
+ * Parse time of one grammar without actions, with a typed Act on every
+ * token and with std::function actions on every token, over a sum of the
+ * given number of terms (100000 by default).
+ */
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "lexer.hpp"
+#include "parsers.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+enum Tags { NUM = 1, ADD, SPACE };
+
+size_t counter = 0;
+
+struct Count {
+    void operator () (State&) const { ++counter; }
+};
+
+// sum = num + '+' + sum | num
+struct Plain {};
+struct Typed {};
+
+auto grammar(Plain) {
+    return (Atom(NUM) + Atom(ADD) + Rec<Plain>()) | Atom(NUM);
+}
+
+auto grammar(Typed) {
+    const auto num = Act(Atom(NUM)).on_accept(Count());
+    const auto add = Act(Atom(ADD)).on_accept(Count());
+    return (num + add + Rec<Typed>()) | num;
+}
+
+
+double measure(Driver& driver, const TokenStream& tokens) {
+    driver.accept(tokens);  // warm up the packrat table
+    const auto start = std::chrono::steady_clock::now();
+    if (!driver.accept(tokens)) { std::exit(EXIT_FAILURE); }
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count() / tokens.size();
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    const size_t terms = argc > 1 ? std::atoll(argv[1]) : 100000;
+    const Lexer lexer({
+        Rule{R"(\d+)", NUM},
+        Rule{R"(\+)", ADD},
+        Rule{R"(\s+)", SPACE, true}
+    });
+
+    std::string input = "0";
+    for (size_t term = 1; term < terms; ++term) {
+        input += " + " + std::to_string(term % 1000);
+    }
+    TokenStream tokens;
+    lexer.tokenize(input, tokens);
+
+    const Parser num = Parser(Atom(NUM)).on_accept([](State&) { ++counter; });
+    const Parser add = Parser(Atom(ADD)).on_accept([](State&) { ++counter; });
+    Parser sum;
+    const Forward rest = Forward::Decl([&](const Forward&, const State& s) {
+        return sum(s);
+    });
+    sum = (num + add + rest) | num;
+
+    Driver plain(Rec<Plain>{}), typed(Rec<Typed>{}), erased(sum);
+    for (Driver* driver : {&plain, &typed, &erased}) { driver->packrat(); }
+
+    const double none = measure(plain, tokens);
+    const double inline_ns = measure(typed, tokens);
+    const double function_ns = measure(erased, tokens);
+    std::cout << std::setw(10) << "tokens" << std::setw(12) << "none ns"
+              << std::setw(12) << "Act ns" << std::setw(14) << "Action ns"
+              << "\n"
+              << std::setw(10) << tokens.size() << std::setw(12) << none
+              << std::setw(12) << inline_ns << std::setw(14) << function_ns
+              << "\n";
+    return counter ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,120 @@
+/*
+ * Cost of building and freeing a node-heavy tree with heap allocated nodes,
+ * a single reused arena and a pool of arenas. Each parse builds one leaf per
+ * number and one group per '+', over an input of the given number of terms
+ * (1000 by default).
+ */
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "lexer.hpp"
+#include "parsers.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+enum Tags { NUM = 1, ADD, SPACE };
+
+
+class Leaf final : public AST {
+    std::string _text;
+
+public:
+    Leaf(const std::string& text) : _text(text) {}
+
+    void append(AST*) override {}
+    void pop(AST*) override {}
+    void accept(Visitor*) const override {}
+};
+
+
+class Group final : public AST {
+public:
+    std::vector<AST*> children;
+
+    void append(AST* child) override { children.push_back(child); }
+    void pop(AST* child) override { std::erase(children, child); }
+    void accept(Visitor*) const override {}
+};
+
+
+void destroy(AST* node) {
+    if (auto group = dynamic_cast<Group*>(node)) {
+        for (AST* child : group->children) { destroy(child); }
+    }
+    delete node;
+}
+
+
+template <typename Parse> double measure(size_t rounds, Parse parse) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; ++round) {
+        if (!parse()) { std::exit(EXIT_FAILURE); }
+    }
+    return std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now() - start).count() / rounds;
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    const size_t terms = argc > 1 ? std::atoll(argv[1]) : 1000;
+    const size_t rounds = 200;
+    const Lexer lexer({
+        Rule{R"(\d+)", NUM},
+        Rule{R"(\+)", ADD},
+        Rule{R"(\s+)", SPACE, true}
+    });
+
+    std::string input = "0";
+    for (size_t term = 1; term < terms; ++term) {
+        input += " + " + std::to_string(term);
+    }
+    TokenStream tokens;
+    lexer.tokenize(input, tokens);
+
+    // sum = num + '+' + sum | num
+    const Parser num = Parser(Atom(NUM))
+        .on_accept(primary_type_builder<Leaf>());
+    Parser sum;
+    const Forward rest = Forward::Decl([&](const Forward&, const State& s) {
+        return sum(s);
+    });
+    sum = Parser((num + Atom(ADD) + rest) | num)
+        .on_before(before_action<Group>)
+        .on_accept(accept_action);
+    Driver driver(sum);
+
+    const double heap = measure(rounds, [&] {
+        const SyntaxTree tree = driver.parse(tokens);
+        destroy(tree.root());
+        return tree.root() != nullptr;
+    });
+
+    Arena arena;
+    const double single = measure(rounds, [&] {
+        const bool accept = driver.parse(tokens, arena).root() != nullptr;
+        arena.release();
+        return accept;
+    });
+
+    ArenaPool pool;
+    const double pooled = measure(rounds, [&] {
+        ArenaPool::Lease lease = pool.acquire();
+        return driver.parse(tokens, *lease).root() != nullptr;
+    });
+
+    std::cout << std::setw(10) << "nodes" << std::setw(12) << "heap us"
+              << std::setw(12) << "arena us" << std::setw(12) << "pool us"
+              << "\n"
+              << std::setw(10) << 2 * terms << std::setw(12) << heap
+              << std::setw(12) << single << std::setw(12) << pooled << "\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,87 @@
+/*
+ * Documents per second of Batch::parse for 1, 2, 4, ... threads up to the
+ * number of cores, on the given number of documents (20000 by default)
+ * whose sizes differ by three orders of magnitude.
+ */
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "batch.hpp"
+#include "lexer.hpp"
+#include "parsers.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+enum Tags { NAME = 1, NUM, ASSIGN, ADD, OPEN, CLOSE, SEMI, SPACE };
+enum Kinds { PROGRAM, STATEMENT, SUM, VALUE };
+
+}
+
+
+int main(int argc, char** argv) {
+    const size_t documents = argc > 1 ? std::atoll(argv[1]) : 20000;
+
+    const Lexer lexer({
+        Rule{R"([a-z]\w*)", NAME},
+        Rule{R"(\d+)", NUM},
+        Rule{"=", ASSIGN},
+        Rule{R"(\+)", ADD},
+        Rule{R"(\()", OPEN},
+        Rule{R"(\))", CLOSE},
+        Rule{";", SEMI},
+        Rule{R"(\s+)", SPACE, true}
+    });
+
+    Parser sum;
+    const Parser value = Parser(Atom(NAME) | Atom(NUM) |
+        (Atom(OPEN) + Ref(sum) + Atom(CLOSE))).kind(VALUE);
+    sum = Parser(SepBy(value, Atom(ADD))).kind(SUM);
+    const Parser statement =
+        Parser(Atom(NAME) + Atom(ASSIGN) + sum + Atom(SEMI)).kind(STATEMENT);
+    const Parser program = Parser(Many(statement)).kind(PROGRAM);
+    Driver driver(program);
+    driver.compile();
+
+    // mostly small documents and a few up to a thousand times larger
+    std::mt19937 random(1);
+    std::vector<std::string> inputs(documents);
+    size_t bytes = 0;
+    for (std::string& input : inputs) {
+        const size_t lines = random() % 100 == 0 ? 1 + random() % 2000
+                                                 : 1 + random() % 20;
+        for (size_t line = 0; line < lines; ++line) {
+            input += "x = (a + 1) + b" + std::to_string(line) + " + 2;\n";
+        }
+        bytes += input.size();
+    }
+
+    const unsigned cores = std::thread::hardware_concurrency();
+    double base = 0;
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "docs/s"
+              << std::setw(10) << "MB/s" << std::setw(10) << "speedup"
+              << "\n";
+    for (unsigned threads = 1; threads <= cores; threads *= 2) {
+        const Batch batch(lexer, driver, threads);
+        const auto start = std::chrono::steady_clock::now();
+        const std::vector<Parsed> results = batch.parse(inputs);
+        const double elapsed = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        for (const Parsed& result : results) {
+            if (!result.accept) return EXIT_FAILURE;
+        }
+        const double speed = documents / elapsed;
+        base = threads == 1 ? speed : base;
+        std::cout << std::setw(8) << threads << std::setw(12) << speed
+                  << std::setw(10) << bytes / elapsed / (1 << 20)
+                  << std::setw(10) << speed / base << "\n";
+    }
+    return EXIT_SUCCESS;
+}
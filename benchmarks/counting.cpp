@@ -0,0 +1,24 @@
+/*
+ * The global allocation functions of parselib_bench, which count every
+ * allocation. They live apart from suite.cpp so that the compiler never
+ * inlines a std::free next to a new-expression, which -Wmismatched-new-delete
+ * reports even though both ends go through malloc.
+ */
+#include <new>
+#include <cstdlib>
+
+#include "counting.hpp"
+
+
+std::atomic<uint64_t> allocations{0};
+
+
+void* operator new (size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+
+void operator delete (void* memory) noexcept { std::free(memory); }
+void operator delete (void* memory, size_t) noexcept { std::free(memory); }
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+
+// Number of calls to the global operator new so far, see counting.cpp
+extern std::atomic<uint64_t> allocations;
@@ -0,0 +1,86 @@
+/*
+ * A 40-way statement dispatch as a chain of Or and as a Choice, natively
+ * and on the VM, over the given number of statements (5000 by default).
+ */
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "lexer.hpp"
+#include "parsers.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+constexpr Tag KEYWORDS = 40;
+enum Tags { NUM = KEYWORDS + 1, SEMI, SPACE };
+
+
+double measure(Driver& driver, const TokenStream& tokens) {
+    const size_t rounds = 20;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; ++round) {
+        if (!driver.accept(tokens)) { std::exit(EXIT_FAILURE); }
+    }
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count() /
+        (rounds * tokens.size());
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    const size_t statements = argc > 1 ? std::atoll(argv[1]) : 5000;
+
+    Rules rules;
+    for (Tag keyword = 0; keyword < KEYWORDS; ++keyword) {
+        rules.push_back(Rule{"k" + std::to_string(keyword), keyword + 1});
+    }
+    rules.push_back(Rule{R"(\d+)", NUM});
+    rules.push_back(Rule{";", SEMI});
+    rules.push_back(Rule{R"(\s+)", SPACE, true});
+    const Lexer lexer(rules, Priority::Longest);
+
+    std::string input;
+    for (size_t statement = 0; statement < statements; ++statement) {
+        input += "k" + std::to_string(statement * 7 % KEYWORDS) + " 1;\n";
+    }
+    TokenStream tokens;
+    lexer.tokenize(input, tokens);
+
+    // statement_k = keyword_k + num + ';', block = statement + block | ...
+    std::vector<Parser> alternatives;
+    for (Tag keyword = 0; keyword < KEYWORDS; ++keyword) {
+        alternatives.push_back(Atom(keyword + 1) + Atom(NUM) + Atom(SEMI));
+    }
+    Parser chain = alternatives[0];
+    for (size_t index = 1; index < alternatives.size(); ++index) {
+        chain = chain | alternatives[index];
+    }
+    const Parser choice = Choice(alternatives);
+
+    Parser ordered, dispatched;
+    ordered = (chain + Ref(ordered)) | chain;
+    dispatched = (choice + Ref(dispatched)) | choice;
+
+    Driver native_or(ordered), native_choice(dispatched);
+    Driver vm_or(ordered), vm_choice(dispatched);
+    vm_or.compile();
+    vm_choice.compile();
+
+    std::cout << std::setw(10) << "tokens" << std::setw(12) << "Or ns"
+              << std::setw(12) << "Choice ns" << std::setw(12) << "VM Or ns"
+              << std::setw(14) << "VM Choice ns" << "\n"
+              << std::setw(10) << tokens.size()
+              << std::setw(12) << measure(native_or, tokens)
+              << std::setw(12) << measure(native_choice, tokens)
+              << std::setw(12) << measure(vm_or, tokens)
+              << std::setw(14) << measure(vm_choice, tokens) << "\n";
+    return EXIT_SUCCESS;
+}
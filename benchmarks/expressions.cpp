@@ -0,0 +1,75 @@
+/*
+ * Arithmetic expressions parsed by a grammar with one layer of alternatives
+ * per precedence level, with and without packrat, and by the Operators
+ * combinator, over an input of the size given in KB (256 by default).
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "lexer.hpp"
+#include "parsers.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+enum Tags { NUM = 1, ADD, MUL, OPEN, CLOSE, SPACE };
+
+
+double measure(Driver& driver, const TokenStream& tokens) {
+    driver.accept(tokens);
+    const auto start = std::chrono::steady_clock::now();
+    if (!driver.accept(tokens)) { std::exit(EXIT_FAILURE); }
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count() / tokens.size();
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    const size_t size = (argc > 1 ? std::atoll(argv[1]) : 256) << 10;
+    const Lexer lexer({
+        Rule{R"(\d+)", NUM},
+        Rule{R"(\+)", ADD},
+        Rule{R"(\*)", MUL},
+        Rule{R"(\()", OPEN},
+        Rule{R"(\))", CLOSE},
+        Rule{R"(\s+)", SPACE, true}
+    });
+
+    std::string input = "(1 + 2 * 3) * 4";
+    while (input.size() < size) { input += " + (56 * (7 + 8) + 9) * 10"; }
+    TokenStream tokens;
+    lexer.tokenize(input, tokens);
+
+    // sum = product + '+' + sum | product
+    // product = value + '*' + product | value
+    // value = num | '(' + sum + ')'
+    Parser sum, product, value;
+    value = Atom(NUM) | (Atom(OPEN) + Ref(sum) + Atom(CLOSE));
+    product = (Ref(value) + Atom(MUL) + Ref(product)) | Ref(value);
+    sum = (Ref(product) + Atom(ADD) + Ref(sum)) | Ref(product);
+
+    Parser expr;
+    expr = Operators(Atom(NUM) | (Atom(OPEN) + Ref(expr) + Atom(CLOSE)))
+        .infix(ADD, 1)
+        .infix(MUL, 2);
+
+    Driver layered(sum), memoized(sum), operators(expr);
+    memoized.packrat();
+
+    const double layered_ns = measure(layered, tokens);
+    const double memoized_ns = measure(memoized, tokens);
+    const double operators_ns = measure(operators, tokens);
+    std::cout << std::setw(10) << "tokens" << std::setw(14) << "layered ns"
+              << std::setw(14) << "packrat ns" << std::setw(14)
+              << "operators ns" << "\n"
+              << std::setw(10) << tokens.size() << std::setw(14) << layered_ns
+              << std::setw(14) << memoized_ns << std::setw(14) << operators_ns
+              << "\n";
+    return EXIT_SUCCESS;
+}
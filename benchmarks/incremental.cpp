@@ -0,0 +1,90 @@
+/*
+ * One-character edits in the middle of a document of the given number of
+ * lines (50000 by default): lexing and parsing the whole text again
+ * against Document::edit.
+ */
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "lexer.hpp"
+#include "parsers.hpp"
+#include "document.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+enum Tags { NAME = 1, NUM, ASSIGN, ADD, OPEN, CLOSE, SEMI, SPACE };
+enum Kinds { PROGRAM, STATEMENT, SUM, VALUE };
+
+
+template <typename Edit> double measure(Edit&& edit) {
+    const size_t rounds = 20;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; ++round) {
+        if (!edit(round)) { std::exit(EXIT_FAILURE); }
+    }
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count() / rounds;
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    const size_t lines = argc > 1 ? std::atoll(argv[1]) : 50000;
+
+    const Lexer lexer({
+        Rule{R"([a-z]\w*)", NAME},
+        Rule{R"(\d+)", NUM},
+        Rule{"=", ASSIGN},
+        Rule{R"(\+)", ADD},
+        Rule{R"(\()", OPEN},
+        Rule{R"(\))", CLOSE},
+        Rule{";", SEMI},
+        Rule{R"(\s+)", SPACE, true}
+    });
+
+    // program = statement*, statement = name '=' sum ';',
+    // sum = value ('+' value)*, value = name | num | '(' sum ')'
+    Parser sum;
+    const Parser value = Parser(Atom(NAME) | Atom(NUM) |
+        (Atom(OPEN) + Ref(sum) + Atom(CLOSE))).kind(VALUE);
+    sum = Parser(SepBy(value, Atom(ADD))).kind(SUM);
+    const Parser statement =
+        Parser(Atom(NAME) + Atom(ASSIGN) + sum + Atom(SEMI)).kind(STATEMENT);
+    const Parser program = Parser(Many(statement)).kind(PROGRAM);
+
+    std::string text;
+    for (size_t line = 0; line < lines; ++line) {
+        text += "x" + std::to_string(line) + " = (a + 1) + b" +
+                std::to_string(line % 10) + " + 2;\n";
+    }
+    const size_t offset = text.find('1', text.length() / 2);
+
+    Driver driver(program);
+    TokenStream tokens;
+    FlatTree tree;
+    std::string full = text;
+    const double whole = measure([&](size_t round) {
+        full[offset] = '0' + round % 10;
+        lexer.tokenize(full, tokens);
+        return driver.parse(tokens, tree);
+    });
+
+    Document document(lexer, program, text);
+    const double incremental = measure([&](size_t round) {
+        return document.edit(offset, 1, std::string(1, '0' + round % 10));
+    });
+
+    std::cout << std::setw(10) << "lines" << std::setw(12) << "tokens"
+              << std::setw(12) << "full ms" << std::setw(16)
+              << "incremental ms" << "\n"
+              << std::setw(10) << lines << std::setw(12) << tokens.size()
+              << std::setw(12) << std::fixed << std::setprecision(3) << whole
+              << std::setw(16) << incremental << "\n";
+}
@@ -0,0 +1,86 @@
+/*
+ * Lexing up front against lexing as the parse reads, on a statement list
+ * that is valid and on one with an error near the start. Lexed on demand,
+ * a compiled accept holds a window of tokens rather than all of them, and
+ * a rejected input is lexed only up to the error.
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "lexer.hpp"
+#include "parsers.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+enum Tags { NAME = 1, NUM, ASSIGN, SEMICOLON, SPACE };
+
+
+template <typename Function>
+double best(Function&& function) {
+    double best = 1e300;
+    for (int round = 0; round < 3; ++round) {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        best = std::min(best, std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    const size_t statements = argc > 1 ? std::atoll(argv[1]) : 1000000;
+    const Lexer lexer({
+        Rule{"[a-z]+", NAME},
+        Rule{R"(\d+)", NUM},
+        Rule{"=", ASSIGN},
+        Rule{";", SEMICOLON},
+        Rule{R"(\s+)", SPACE, true}
+    });
+    Driver driver{Many(Atom(NAME) + Atom(ASSIGN) + Atom(NUM) +
+                       Atom(SEMICOLON))};
+    driver.compile();
+
+    std::string valid;
+    for (size_t index = 0; index < statements; ++index) {
+        valid += "value = " + std::to_string(index) + ";\n";
+    }
+    // a statement missing its semicolon lexes fine and fails the parse
+    std::string broken = valid;
+    broken[valid.find(';', valid.size() / 100)] = ' ';
+
+    std::cout << std::setw(10) << "input" << std::setw(8) << "mode"
+              << std::setw(12) << "ms" << std::setw(12) << "kept"
+              << "\n";
+    for (const auto& [name, text] : {std::pair{"valid", &valid},
+                                     std::pair{"broken", &broken}}) {
+        TokenStream tokens;
+        Failure failure;
+        const double eager = best([&] {
+            if (lexer.tokenize(*text, tokens, failure)) {
+                driver.accept(tokens);
+            }
+        });
+        std::cout << std::setw(10) << name << std::setw(8) << "eager"
+                  << std::setw(12) << std::setprecision(4) << eager * 1e3
+                  << std::setw(12) << tokens.size() << "\n";
+
+        size_t held = 0;
+        const double lazy = best([&] {
+            TokenSource source(lexer, *text);
+            driver.accept(source);
+            held = source.tokens().size() - source.tokens().first();
+        });
+        std::cout << std::setw(10) << name << std::setw(8) << "lazy"
+                  << std::setw(12) << std::setprecision(4) << lazy * 1e3
+                  << std::setw(12) << held << "\n";
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,83 @@
+/*
+ * Throughput on keyword and operator dense input as the keyword set grows.
+ * Past the size one automaton can hold, keywords and operators move to the
+ * literal trie instead of being tried one rule at a time.
+ */
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "lexer.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+enum Tags { NAME = 1, NUM, SPACE, OPERATOR, KEYWORD };
+
+const char* operators[] = {
+    R"(\+)", R"(\+\+)", R"(\+=)", "-", "--", "-=", R"(\*)", "/", "=", "==",
+    "!=", "<", "<=", ">", ">=", "&&", R"(\|\|)", R"(\()", R"(\))", ";", ","
+};
+
+
+Rules rules(unsigned keywords) {
+    Rules rules;
+    for (unsigned keyword = 0; keyword < keywords; ++keyword) {
+        rules.push_back(Rule{"k" + std::to_string(keyword) + "w",
+                             KEYWORD + keyword});
+    }
+    for (const char* pattern : operators) {
+        rules.push_back(Rule{pattern, OPERATOR});
+    }
+    rules.push_back(Rule{"[A-Za-z_][A-Za-z0-9_]*", NAME});
+    rules.push_back(Rule{R"(\d+)", NUM});
+    rules.push_back(Rule{R"(\s+)", SPACE, true});
+    return rules;
+}
+
+
+std::string input(unsigned keywords, size_t size) {
+    const char* symbols[] = {"+", "++", "+=", "==", "(", ")", ";", "<=",
+                             "&&", ","};
+    std::mt19937 random(7);
+    std::string out;
+    while (out.size() < size) {
+        out += "k" + std::to_string(random() % keywords) + "w ";
+        out += symbols[random() % std::size(symbols)];
+        out += random() % 2 ? " name_" + std::to_string(random() % 100)
+                            : " " + std::to_string(random() % 1000);
+        out += "\n";
+    }
+    return out;
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    const size_t size = (argc > 1 ? std::atoll(argv[1]) : 4) << 20;
+    std::cout << std::setw(10) << "keywords" << std::setw(10) << "states"
+              << std::setw(8) << "trie" << std::setw(12) << "MB/s\n";
+    for (unsigned keywords : {16u, 256u, 4096u, 16384u}) {
+        const Lexer lexer(rules(keywords));
+        const std::string text = input(keywords, size);
+        TokenStream tokens;
+        double best = 1e300;
+        for (int round = 0; round < 3; ++round) {
+            const auto start = std::chrono::steady_clock::now();
+            lexer.tokenize(text, tokens);
+            best = std::min(best, std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+        std::cout << std::setw(10) << keywords << std::setw(10)
+                  << lexer.scanner().states() << std::setw(8)
+                  << (lexer.literals().empty() ? "no" : "yes")
+                  << std::setw(11) << std::setprecision(4)
+                  << text.size() / best / (1 << 20) << "\n";
+    }
+    return EXIT_SUCCESS;
+}
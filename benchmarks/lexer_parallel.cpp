@@ -0,0 +1,49 @@
+/*
+ * Throughput of the chunked parallel tokenizer for 1, 2, 4, ... threads up
+ * to the number of cores, on an input of the size given in MB (256 by
+ * default).
+ */
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "lexer.hpp"
+
+using namespace parselib;
+
+
+int main(int argc, char** argv) {
+    const size_t size = (argc > 1 ? std::atoll(argv[1]) : 256) << 20;
+    const Lexer lexer({
+        Rule{R"("[^"]*")", 1},
+        Rule{"[A-Za-z_][A-Za-z0-9_]*", 2},
+        Rule{R"(\d+)", 3},
+        Rule{R"([-+*/=(),;])", 4},
+        Rule{R"(\s+)", 5, true}
+    });
+
+    static const std::string line =
+        "result_value = compute(1234567, \"text 89\") * (other + 42);\n";
+    std::string input;
+    input.reserve(size + line.size());
+    while (input.size() < size) { input += line; }
+
+    TokenStream tokens;
+    const unsigned cores = std::thread::hardware_concurrency();
+    double base = 0;
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "MB/s"
+              << std::setw(10) << "speedup" << "\n";
+    for (unsigned threads = 1; threads <= cores; threads *= 2) {
+        const auto start = std::chrono::steady_clock::now();
+        lexer.tokenize(input, tokens, threads);
+        const double elapsed = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        const double speed = input.size() / elapsed / (1 << 20);
+        base = threads == 1 ? speed : base;
+        std::cout << std::setw(8) << threads << std::setw(12) << speed
+                  << std::setw(10) << speed / base << "\n";
+    }
+    return EXIT_SUCCESS;
+}
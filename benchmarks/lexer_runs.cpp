@@ -0,0 +1,61 @@
+/*
+ * Throughput on run-dominated inputs: long whitespace gaps, digit runs and
+ * identifiers, which scanner states consume with the vectorized skips.
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "lexer.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+double throughput(const Lexer& lexer, const std::string& input) {
+    TokenStream tokens;
+    double best = 1e300;
+    for (int round = 0; round < 5; ++round) {
+        const auto start = std::chrono::steady_clock::now();
+        lexer.tokenize(input, tokens);
+        best = std::min(best, std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+    return input.size() / best / (1 << 30);
+}
+
+
+std::string repeat(const std::string& line, size_t size) {
+    std::string out;
+    out.reserve(size + line.size());
+    while (out.size() < size) { out += line; }
+    return out;
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    const size_t size = (argc > 1 ? std::atoll(argv[1]) : 64) << 20;
+    const Lexer lexer({
+        Rule{"[A-Za-z_][A-Za-z0-9_]*", 1},
+        Rule{R"(\d+)", 2},
+        Rule{R"([-+*/=;])", 3},
+        Rule{R"(\s+)", 4, true}
+    });
+
+    const std::pair<const char*, std::string> inputs[] = {
+        {"whitespace", repeat("x" + std::string(254, ' ') + "\n", size)},
+        {"digits", repeat(std::string(120, '7') + " + ", size)},
+        {"identifiers", repeat("some_rather_long_identifier_name = other;\n",
+                               size)},
+    };
+    for (const auto& [name, input]: inputs) {
+        std::cout << std::setw(12) << name << std::setw(10)
+                  << std::setprecision(3) << throughput(lexer, input)
+                  << " GB/s\n";
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+/*
+ * Lexer::tokenize must stay linear in the input size. The corpus is grown
+ * from 1 KB up to the limit given in MB (100 by default) and the time per
+ * byte is compared against the smaller inputs; a quadratic regression shows
+ * up as a growing ns/byte column and a non-zero exit code.
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include "lexer.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+enum Tag { COMMENT = 1, NAME, NUM, ASSIGN, ADD, MUL, OPEN, CLOSE, SPACE };
+
+Rules rules() {
+    return Rules {
+        // std::regex-only rule, tried before the automaton result everywhere
+        Rule{R"(^#[^\n]*)", COMMENT, true},
+        Rule{"[A-Za-z_][A-Za-z0-9_]*", NAME},
+        Rule{R"(\d+)", NUM},
+        Rule{"=", ASSIGN},
+        Rule{R"(\+|-)", ADD},
+        Rule{R"(\*|/)", MUL},
+        Rule{R"(\()", OPEN},
+        Rule{R"(\))", CLOSE},
+        Rule{R"(\s+)", SPACE, true}
+    };
+}
+
+
+std::string corpus(size_t size) {
+    static const std::string line =
+        "# the quick brown fox jumps over the lazy dog\n"
+        "result_value = 1234567 + (other_value * 89)\n";
+    std::string out;
+    out.reserve(size + line.size());
+    while (out.size() < size) { out += line; }
+    out.resize(size);
+    out.back() = '\n';
+    return out;
+}
+
+
+double seconds(const Lexer& lexer, const std::string& input, size_t& tokens) {
+    using Clock = std::chrono::steady_clock;
+    TokenStream stream;
+    double best = 1e300, total = 0;
+    for (int round = 0; round < 10 && (round < 2 || total < 0.5); ++round) {
+        const auto start = Clock::now();
+        lexer.tokenize(input, stream);
+        tokens = stream.size();
+        const double elapsed =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        best = std::min(best, elapsed);
+        total += elapsed;
+    }
+    return best;
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    const size_t limit = (argc > 1 ? std::atoll(argv[1]) : 100) << 20;
+    const Lexer lexer(rules());
+
+    std::cout << std::setw(12) << "bytes" << std::setw(12) << "tokens"
+              << std::setw(12) << "seconds" << std::setw(10) << "MB/s"
+              << std::setw(10) << "ns/byte" << "\n";
+
+    std::vector<size_t> sizes;
+    for (size_t unit: {size_t(1) << 10, size_t(1) << 20}) {
+        for (size_t size = unit; size < unit * 1000; size *= 10) {
+            if (size > limit) break;
+            sizes.push_back(size);
+        }
+    }
+    if (sizes.back() != limit) { sizes.push_back(limit); }
+
+    std::vector<double> perByte;
+    for (size_t size: sizes) {
+        const std::string input = corpus(size);
+        size_t tokens = 0;
+        const double elapsed = seconds(lexer, input, tokens);
+        perByte.push_back(elapsed * 1e9 / size);
+        std::cout << std::setw(12) << size << std::setw(12) << tokens
+                  << std::setw(12) << std::setprecision(4) << elapsed
+                  << std::setw(10) << std::setprecision(4)
+                  << size / elapsed / (1 << 20)
+                  << std::setw(10) << perByte.back() << "\n";
+    }
+
+    // the 1 KB run is dominated by fixed costs, compare from 10 KB on
+    const double reference = perByte.size() > 1 ?
+        *std::min_element(perByte.begin() + 1, perByte.end()) : perByte[0];
+    const double ratio = perByte.back() / reference;
+    std::cout << "growth of ns/byte across sizes: " << ratio << "x\n";
+    return ratio < 4.0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
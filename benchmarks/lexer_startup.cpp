@@ -0,0 +1,86 @@
+/*
+ * What building a lexer costs a short-lived process: the rules of
+ * startup.lex compiled at run time against the lexer parselib_lexgen
+ * generated from them, and the throughput of both once built.
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "lexer.hpp"
+#include "startup.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+double since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+
+double throughput(const Lexer& lexer, const std::string& input) {
+    TokenStream tokens;
+    double best = 1e300;
+    for (int round = 0; round < 5; ++round) {
+        const auto start = std::chrono::steady_clock::now();
+        lexer.tokenize(input, tokens);
+        best = std::min(best, since(start));
+    }
+    return input.size() / best / (1 << 20);
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    const size_t size = (argc > 1 ? std::atoll(argv[1]) : 16) << 20;
+
+    // the generated lexer is built once per process, so it goes first
+    auto start = std::chrono::steady_clock::now();
+    const Lexer& generated = startup::lexer();
+    const double load = since(start);
+
+    start = std::chrono::steady_clock::now();
+    const Lexer runtime({
+        Rule{"if", startup::IF},
+        Rule{"else", startup::ELSE},
+        Rule{"while", startup::WHILE},
+        Rule{"for", startup::FOR},
+        Rule{"return", startup::RETURN},
+        Rule{"int", startup::INT},
+        Rule{"char", startup::CHAR},
+        Rule{"void", startup::VOID},
+        Rule{"struct", startup::STRUCT},
+        Rule{"[A-Za-z_][A-Za-z0-9_]*", startup::NAME},
+        Rule{R"(\d+(\.\d+)?)", startup::NUMBER},
+        Rule{R"("([^"\\]|\\.)*")", startup::STRING},
+        Rule{R"(\+\+|--|\+=|-=|==|!=|<=|>=|&&|\|\||[-+*/%<>=!&|^~])",
+             startup::OP},
+        Rule{R"([(){}\[\];,.])", startup::PUNCT},
+        Rule{R"(\s+)", startup::SPACE, true},
+        Rule{R"(//[^\n]*)", startup::COMMENT, true}
+    });
+    const double compile = since(start);
+
+    std::string input;
+    while (input.size() < size) {
+        input += "int main(void) { // entry\n"
+                 "    for (int i = 0; i < 10; ++i) { x += f(i, 2.5); }\n"
+                 "    if (x != 0 && y) return \"done\"; else return 0;\n"
+                 "}\n";
+    }
+
+    std::cout << std::setw(10) << "" << std::setw(14) << "build ms"
+              << std::setw(10) << "MB/s\n" << std::setprecision(4);
+    std::cout << std::setw(10) << "runtime" << std::setw(14)
+              << compile * 1e3 << std::setw(10)
+              << throughput(runtime, input) << "\n";
+    std::cout << std::setw(10) << "generated" << std::setw(14)
+              << load * 1e3 << std::setw(10)
+              << throughput(generated, input) << "\n";
+    return EXIT_SUCCESS;
+}
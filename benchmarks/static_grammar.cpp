@@ -0,0 +1,103 @@
+/*
+ * The same arithmetic grammar run through type-erased Parser/Forward
+ * objects, through statically dispatched Rec<> references and as bytecode
+ * on the VM, on one token stream of the size given in KB (256 by default).
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "lexer.hpp"
+#include "parsers.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+enum Tags { NUM = 1, ADD, MUL, OPEN, CLOSE, SPACE };
+
+// sum = product + '+' + sum | product
+// product = value + '*' + product | value
+// value = num | '(' + sum + ')'
+struct Sum {};
+struct Product {};
+struct Value {};
+
+auto grammar(Value) {
+    return Atom(NUM) | (Atom(OPEN) + Rec<Sum>() + Atom(CLOSE));
+}
+
+auto grammar(Product) {
+    return (Rec<Value>() + Atom(MUL) + Rec<Product>()) | Rec<Value>();
+}
+
+auto grammar(Sum) {
+    return (Rec<Product>() + Atom(ADD) + Rec<Sum>()) | Rec<Product>();
+}
+
+
+double measure(Driver& driver, const TokenStream& tokens) {
+    const auto start = std::chrono::steady_clock::now();
+    if (!driver.accept(tokens)) { std::exit(EXIT_FAILURE); }
+    const double elapsed = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+    return elapsed / tokens.size();
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    const size_t size = (argc > 1 ? std::atoll(argv[1]) : 256) << 10;
+    const Lexer lexer({
+        Rule{R"(\d+)", NUM},
+        Rule{R"(\+)", ADD},
+        Rule{R"(\*)", MUL},
+        Rule{R"(\()", OPEN},
+        Rule{R"(\))", CLOSE},
+        Rule{R"(\s+)", SPACE, true}
+    });
+
+    std::string input = "(1 + 2 * 3) * 4";
+    while (input.size() < size) { input += " + (56 * (7 + 8) + 9) * 10"; }
+    TokenStream tokens;
+    lexer.tokenize(input, tokens);
+
+    Parser sum, product, value;
+    const auto sum_ref = Forward::Decl([&](const Forward&, const State& s) {
+        return sum(s);
+    });
+    value = Atom(NUM) | (Atom(OPEN) + sum_ref + Atom(CLOSE));
+    product = Forward::Decl([&](const Forward& self, const State& s) {
+        return ((value + Atom(MUL) + self) | value)(s);
+    });
+    sum = Forward::Decl([&](const Forward& self, const State& s) {
+        return ((product + Atom(ADD) + self) | product)(s);
+    });
+
+    Parser vm_sum, vm_product, vm_value;
+    vm_value = Atom(NUM) | (Atom(OPEN) + Ref(vm_sum) + Atom(CLOSE));
+    vm_product = (Ref(vm_value) + Atom(MUL) + Ref(vm_product)) |
+                 Ref(vm_value);
+    vm_sum = (Ref(vm_product) + Atom(ADD) + Ref(vm_sum)) | Ref(vm_product);
+
+    Driver dynamic(sum);
+    Driver fixed(Rec<Sum>{});
+    Driver compiled(vm_sum);
+    dynamic.packrat();
+    fixed.packrat();
+    compiled.packrat().compile();
+
+    const double dynamic_ns = measure(dynamic, tokens);
+    const double static_ns = measure(fixed, tokens);
+    const double vm_ns = measure(compiled, tokens);
+    std::cout << std::setw(10) << "tokens" << std::setw(14) << "dynamic ns"
+              << std::setw(14) << "static ns" << std::setw(10) << "vm ns"
+              << "\n"
+              << std::setw(10) << tokens.size() << std::setw(14) << dynamic_ns
+              << std::setw(14) << static_ns << std::setw(10) << vm_ns
+              << "\n";
+    return EXIT_SUCCESS;
+}
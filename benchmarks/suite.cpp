@@ -0,0 +1,487 @@
+/*
+ * The parselib_bench suite: microbenchmarks of Rule matching, lexing,
+ * combinator calls and whole parses of generated corpora, written as JSON
+ * so that runs of different releases can be compared.
+ *
+ *     parselib_bench [--out FILE] [--quick] [--repetitions N]
+ *
+ * Inputs come from fixed seeds and every figure is the median of the
+ * repetitions, each of which runs long enough to swamp the clock.
+ * Allocations are counted through the global operator new, see
+ * counting.cpp.
+ */
+#include <new>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#include "lexer.hpp"
+#include "parsers.hpp"
+#include "counting.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+enum Tags {
+    NUM = 1, NAME, STRING, ADD, MUL, OPEN, CLOSE, LBRACE, RBRACE, LBRACK,
+    RBRACK, COLON, COMMA, ASSIGN, SPACE
+};
+
+constexpr uint32_t seed = 20240601;
+volatile uint64_t sink = 0;
+
+
+struct Options {
+    std::string out;
+    bool quick = false;
+    size_t repetitions = 7;
+};
+
+
+struct Result {
+    std::string group;
+    std::string name;
+    std::map<std::string, std::string> params;
+    std::map<std::string, double> metrics;
+};
+
+
+/*
+ * Median nanoseconds of one call to `run`, which does `count` units of
+ * work per call, together with the allocations per unit.
+ */
+struct Timing {
+    double ns = 0;
+    double allocations = 0;
+};
+
+
+Timing measure(const Options& options, size_t count,
+               const std::function<void()>& run) {
+    run();  // warm up caches and reusable buffers
+
+    // enough calls per repetition to take at least ~20ms
+    size_t calls = 1;
+    for (;;) {
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t call = 0; call < calls; ++call) { run(); }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed > std::chrono::milliseconds(20) || calls >= (1u << 24)) {
+            break;
+        }
+        calls *= 2;
+    }
+
+    std::vector<double> samples;
+    uint64_t allocated = 0;
+    for (size_t round = 0; round < options.repetitions; ++round) {
+        const uint64_t before = allocations.load();
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t call = 0; call < calls; ++call) { run(); }
+        const double elapsed = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count();
+        allocated += allocations.load() - before;
+        samples.push_back(elapsed / (double(calls) * count));
+    }
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2,
+                     samples.end());
+    return Timing{samples[samples.size() / 2],
+                  double(allocated) / (double(calls) * count *
+                                       options.repetitions)};
+}
+
+
+Lexer make_lexer() {
+    return Lexer({
+        Rule{R"(\d+)", NUM},
+        Rule{R"([A-Za-z_][A-Za-z0-9_.]*)", NAME},
+        Rule{R"("[^"]*")", STRING},
+        Rule{R"(\+)", ADD},
+        Rule{R"(\*)", MUL},
+        Rule{R"(\()", OPEN},
+        Rule{R"(\))", CLOSE},
+        Rule{R"(\{)", LBRACE},
+        Rule{R"(\})", RBRACE},
+        Rule{R"(\[)", LBRACK},
+        Rule{R"(\])", RBRACK},
+        Rule{":", COLON},
+        Rule{",", COMMA},
+        Rule{"=", ASSIGN},
+        Rule{R"(\s+)", SPACE, true}
+    });
+}
+
+
+
+// ---- corpora, each a sequence of nested blocks up to `size` bytes ----
+
+std::string arithmetic(std::mt19937& random, size_t depth) {
+    if (depth == 0) return std::to_string(random() % 1000);
+    std::string inner = arithmetic(random, depth - 1);
+    return "(" + inner + (random() % 2 ? " + " : " * ") +
+           std::to_string(random() % 100) + ")";
+}
+
+
+std::string json(std::mt19937& random, size_t depth) {
+    if (depth == 0) {
+        switch (random() % 3) {
+        case 0: return std::to_string(random() % 100000);
+        case 1: return "\"text " + std::to_string(random() % 100) + "\"";
+        default: return random() % 2 ? "true" : "null";
+        }
+    }
+    if (random() % 2) {
+        return "[" + json(random, depth - 1) + ", " + json(random, 0) + "]";
+    }
+    return "{\"key\": " + json(random, depth - 1) + ", \"id\": " +
+           json(random, 0) + "}";
+}
+
+
+std::string config(std::mt19937& random, size_t depth) {
+    std::string section = "[section" + std::to_string(random() % 100) + "]\n";
+    for (size_t entry = 0; entry < depth; ++entry) {
+        section += "name" + std::to_string(entry) + " = ";
+        switch (random() % 3) {
+        case 0: section += std::to_string(random() % 100000); break;
+        case 1: section += "\"value\""; break;
+        default: section += "other.section.key"; break;
+        }
+        section += "\n";
+    }
+    return section;
+}
+
+
+std::string corpus(const std::string& kind, size_t size, size_t depth) {
+    std::mt19937 random(seed);
+    std::string text;
+    while (text.size() < size) {
+        if (kind == "arithmetic") {
+            text += (text.empty() ? "" : " + ") + arithmetic(random, depth);
+        } else if (kind == "json") {
+            text += (text.empty() ? "[" : ", ") + json(random, depth);
+        } else {
+            text += config(random, depth);
+        }
+    }
+    if (kind == "json") { text += "]"; }
+    return text;
+}
+
+
+// The grammars of the corpora, the parsers they refer to live here
+struct Grammars {
+    Parser sum, product, value;
+    Parser arithmetic;
+
+    Parser element, members, elements;
+    Parser json;
+
+    Parser config;
+
+    Grammars() {
+        // sum = product ('+' product)*, product = value ('*' value)*,
+        // value = num | '(' sum ')'
+        value = Atom(NUM) | (Atom(OPEN) + Ref(sum) + Atom(CLOSE));
+        product = SepBy(Ref(value), Atom(MUL));
+        sum = SepBy(Ref(product), Atom(ADD));
+        arithmetic = Ref(sum);
+
+        // element = num | string | name | object | array
+        const Parser member = Atom(STRING) + Atom(COLON) + Ref(element);
+        const Parser object = Atom(LBRACE) +
+            Optional(SepBy(member, Atom(COMMA))) + Atom(RBRACE);
+        const Parser array = Atom(LBRACK) +
+            Optional(SepBy(Ref(element), Atom(COMMA))) + Atom(RBRACK);
+        element = Choice(Atom(NUM), Atom(STRING), Atom(NAME), object, array);
+        json = Ref(element);
+
+        // config = (section | entry)*
+        const Parser section = Atom(LBRACK) + Atom(NAME) + Atom(RBRACK);
+        const Parser entry = Atom(NAME) + Atom(ASSIGN) +
+            (Atom(NUM) | Atom(STRING) | Atom(NAME));
+        config = Many(Choice(section, entry));
+    }
+
+    const Parser& operator [] (const std::string& kind) const {
+        if (kind == "arithmetic") return arithmetic;
+        if (kind == "json") return json;
+        return config;
+    }
+};
+
+
+
+void rule_match(const Options& options, std::vector<Result>& results) {
+    // pattern class, pattern and an input it matches at every offset step
+    const std::vector<std::tuple<std::string, std::string, std::string>>
+        classes = {
+            {"literal", R"(\+)", "+"},
+            {"keyword", "while", "while"},
+            {"class_run", "[a-z]+", "identifier"},
+            {"digits", R"(\d+)", "1234567"},
+            {"alternation", "if|else|while|return", "return"},
+            {"quoted", R"("[^"]*")", "\"some quoted text\""},
+            {"backreference", R"((a)\1)", "aa"},
+        };
+
+    for (const auto& [kind, pattern, token] : classes) {
+        const Rule rule(pattern, 1);
+        std::string input;
+        while (input.size() < 4096) { input += token + " "; }
+        const size_t step = token.size() + 1;
+        const size_t count = input.size() / step;
+
+        const Timing at = measure(options, count, [&] {
+            for (size_t offset = 0; offset + step <= input.size();
+                 offset += step) {
+                sink = sink + rule.matchAt(input, offset);
+            }
+        });
+        const Timing search = measure(options, count, [&] {
+            for (size_t offset = 0; offset + step <= input.size();
+                 offset += step) {
+                sink = sink + rule.match(input, offset).size();
+            }
+        });
+        results.push_back({"rule", kind, {{"pattern", pattern}}, {
+            {"match_at_ns", at.ns},
+            {"match_ns", search.ns},
+            {"scanner", rule.scanner ? 1.0 : 0.0},
+        }});
+    }
+}
+
+
+void tokenize(const Options& options, const Lexer& lexer,
+              std::vector<Result>& results) {
+    const size_t size = options.quick ? 256 << 10 : 4 << 20;
+    for (const std::string kind : {"arithmetic", "json", "config"}) {
+        const std::string input = corpus(kind, size, 4);
+        TokenStream tokens;
+        lexer.tokenize(input, tokens);
+        const size_t count = tokens.size();
+
+        const Timing stream = measure(options, count, [&] {
+            lexer.tokenize(input, tokens);
+        });
+        const Timing lexems = measure(options, count, [&] {
+            sink = sink + lexer.tokenize(input).size();
+        });
+        const double bytes = double(input.size()) / count;
+        results.push_back({"lexer", kind, {
+            {"bytes", std::to_string(input.size())},
+            {"tokens", std::to_string(count)},
+        }, {
+            {"token_stream_mb_s", bytes / stream.ns * 1e9 / (1 << 20)},
+            {"token_stream_tokens_s", 1e9 / stream.ns},
+            {"token_stream_allocations_per_token", stream.allocations},
+            {"lexems_mb_s", bytes / lexems.ns * 1e9 / (1 << 20)},
+            {"lexems_tokens_s", 1e9 / lexems.ns},
+            {"lexems_allocations_per_token", lexems.allocations},
+        }});
+    }
+}
+
+
+void combinators(const Options& options, const Lexer& lexer,
+                 std::vector<Result>& results) {
+    std::string input;
+    for (size_t index = 0; index < 2048; ++index) { input += "1 + "; }
+    input += "1";
+    TokenStream tokens;
+    lexer.tokenize(input, tokens);
+    Context context;
+    context.tokens = &tokens;
+    const size_t count = tokens.size() / 2;
+
+    // every combinator starts at each number of "1 + 1 + ..."
+    const auto call = [&](const std::string& name, const IParser& parser) {
+        const Timing timing = measure(options, count, [&] {
+            for (uint32_t position = 0; position + 1 < tokens.size();
+                 position += 2) {
+                sink = sink + parser(State(&context, position)).position;
+            }
+        });
+        results.push_back({"combinator", name, {}, {
+            {"ns_per_call", timing.ns},
+            {"allocations_per_call", timing.allocations},
+        }});
+    };
+
+    const Forward forward = Forward::Decl([](const Forward&, const State& s) {
+        return Atom(NUM)(s);
+    });
+    call("atom", Atom(NUM));
+    call("and", Atom(NUM) + Atom(ADD));
+    call("or", Atom(ADD) | Atom(NUM));
+    call("parser", Parser(Atom(NUM)));
+    call("forward", forward);
+    call("and_parser", Parser(Atom(NUM)) + Parser(Atom(ADD)));
+    call("or_parser", Parser(Atom(ADD)) | Parser(Atom(NUM)));
+}
+
+
+void parse(const Options& options, const Lexer& lexer,
+           std::vector<Result>& results) {
+    const Grammars grammars;
+    const std::vector<size_t> sizes = options.quick
+        ? std::vector<size_t>{16 << 10, 256 << 10}
+        : std::vector<size_t>{16 << 10, 256 << 10, 4 << 20};
+
+    for (const std::string kind : {"arithmetic", "json", "config"}) {
+        Driver native(grammars[kind]);
+        Driver compiled(grammars[kind]);
+        compiled.compile();
+        for (size_t depth : {1, 8, 64}) {
+            for (size_t size : sizes) {
+                const std::string input = corpus(kind, size, depth);
+                TokenStream tokens;
+                lexer.tokenize(input, tokens);
+                const size_t count = tokens.size();
+
+                Session session;
+                std::map<std::string, double> metrics;
+                for (const auto& [mode, driver] :
+                     {std::pair<std::string, const Driver*>{"native", &native},
+                      {"compiled", &compiled}}) {
+                    if (!driver->accept(session, tokens)) {
+                        std::cerr << "the " << kind << " corpus doesn't parse\n";
+                        std::exit(EXIT_FAILURE);
+                    }
+                    const Timing timing = measure(options, count, [&] {
+                        sink = sink + driver->accept(session, tokens);
+                    });
+                    metrics[mode + "_ns_per_token"] = timing.ns;
+                    metrics[mode + "_mb_s"] =
+                        double(input.size()) / count / timing.ns * 1e9 /
+                        (1 << 20);
+                    metrics[mode + "_allocations_per_token"] =
+                        timing.allocations;
+                }
+
+                FlatTree tree;
+                const Timing flat = measure(options, count, [&] {
+                    sink = sink + compiled.parse(session, tokens, tree);
+                });
+                metrics["flat_tree_ns_per_token"] = flat.ns;
+                metrics["flat_tree_allocations_per_token"] = flat.allocations;
+
+                results.push_back({"parse", kind, {
+                    {"depth", std::to_string(depth)},
+                    {"bytes", std::to_string(input.size())},
+                    {"tokens", std::to_string(count)},
+                }, metrics});
+            }
+        }
+    }
+}
+
+
+
+std::string quote(const std::string& text) {
+    std::string out = "\"";
+    for (char symbol : text) {
+        if (symbol == '"' || symbol == '\\') { out += '\\'; }
+        out += symbol;
+    }
+    return out + "\"";
+}
+
+
+void write(std::ostream& os, const Options& options,
+           const std::vector<Result>& results) {
+    os << std::setprecision(6) << "{\n"
+       << "  \"schema\": 1,\n"
+       << "  \"context\": {\n"
+#if defined(__VERSION__)
+       << "    \"compiler\": " << quote(__VERSION__) << ",\n"
+#endif
+#if defined(NDEBUG)
+       << "    \"assertions\": false,\n"
+#else
+       << "    \"assertions\": true,\n"
+#endif
+       << "    \"quick\": " << (options.quick ? "true" : "false") << ",\n"
+       << "    \"repetitions\": " << options.repetitions << ",\n"
+       << "    \"seed\": " << seed << "\n"
+       << "  },\n"
+       << "  \"benchmarks\": [";
+    for (size_t index = 0; index < results.size(); ++index) {
+        const Result& result = results[index];
+        os << (index ? "," : "") << "\n    {\"group\": " << quote(result.group)
+           << ", \"name\": " << quote(result.name) << ",\n     \"params\": {";
+        const char* separator = "";
+        for (const auto& [key, value] : result.params) {
+            os << separator << quote(key) << ": " << quote(value);
+            separator = ", ";
+        }
+        os << "},\n     \"metrics\": {";
+        separator = "";
+        for (const auto& [key, value] : result.metrics) {
+            os << separator << quote(key) << ": " << value;
+            separator = ", ";
+        }
+        os << "}}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int index = 1; index < argc; ++index) {
+        const std::string arg = argv[index];
+        if (arg == "--quick") {
+            options.quick = true;
+        } else if (arg == "--out" && index + 1 < argc) {
+            options.out = argv[++index];
+        } else if (arg == "--repetitions" && index + 1 < argc) {
+            options.repetitions = std::max(std::atoll(argv[++index]), 1ll);
+        } else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--out FILE] [--quick] [--repetitions N]\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    const Lexer lexer = make_lexer();
+    std::vector<Result> results;
+    std::cerr << "rule matching\n";
+    rule_match(options, results);
+    std::cerr << "lexing\n";
+    tokenize(options, lexer, results);
+    std::cerr << "combinators\n";
+    combinators(options, lexer, results);
+    std::cerr << "parsing\n";
+    parse(options, lexer, results);
+
+    if (options.out.empty()) {
+        write(std::cout, options, results);
+    } else {
+        std::ofstream file(options.out);
+        write(file, options, results);
+        if (!file) {
+            std::cerr << "can't write " << options.out << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+#include <cstdint>
+#include <algorithm>
+
+#include "arena.hpp"
+
+using namespace parselib;
+
+
+
+Arena::Arena(size_t block_size) : _block_size(block_size) {}
+
+
+Arena::~Arena() {
+    release();
+}
+
+
+namespace {
+
+// Offset of the first address at or after `offset` in `data` aligned to
+// `alignment`, a power of two
+size_t align(const std::byte* data, size_t offset, size_t alignment) {
+    const auto base = reinterpret_cast<uintptr_t>(data);
+    return ((base + offset + alignment - 1) & ~(alignment - 1)) - base;
+}
+
+}
+
+
+void* Arena::allocate(size_t size, size_t alignment) {
+    // blocks come from operator new[] and are aligned for any object but
+    // over-aligned ones, which may need to skip some bytes
+    const size_t slack = alignment > alignof(std::max_align_t)
+                       ? alignment - 1 : 0;
+    if (size + slack > _block_size) {
+        // Oversized objects get a block of their own, placed behind the
+        // one being filled so its free space is not lost. A free block an
+        // earlier parse left is taken before a new one is made.
+        const size_t at = std::min(_current, _blocks.size());
+        auto found = _blocks.begin() + at + (_used != 0 && at < _blocks.size());
+        while (found != _blocks.end() &&
+               align(found->data.get(), 0, alignment) + size > found->size) {
+            ++found;
+        }
+        if (found == _blocks.end()) {
+            _blocks.push_back({std::make_unique<std::byte[]>(size + slack),
+                               size + slack});
+            found = _blocks.end() - 1;
+        }
+        std::rotate(_blocks.begin() + at, found, found + 1);
+        _current = at + 1;
+        const Block& block = _blocks[at];
+        return block.data.get() + align(block.data.get(), 0, alignment);
+    }
+
+    // free oversized blocks are kept at the back for oversized objects
+    size_t oversized = 0;
+    while (_current + oversized < _blocks.size()) {
+        Block& block = _blocks[_current];
+        if (block.size > _block_size) {
+            std::rotate(_blocks.begin() + _current,
+                        _blocks.begin() + _current + 1, _blocks.end());
+            ++oversized;
+            continue;
+        }
+        const size_t start = align(block.data.get(), _used, alignment);
+        if (start + size <= block.size) {
+            _used = start + size;
+            return block.data.get() + start;
+        }
+        ++_current;
+        _used = 0;
+    }
+
+    const auto block = _blocks.insert(
+        _blocks.begin() + _current,
+        {std::make_unique<std::byte[]>(_block_size), _block_size});
+    const size_t start = align(block->data.get(), 0, alignment);
+    _used = start + size;
+    return block->data.get() + start;
+}
+
+
+void Arena::release() {
+    for (auto cleanup = _cleanups.rbegin(); cleanup != _cleanups.rend();
+         ++cleanup) {
+        cleanup->destroy(cleanup->object);
+    }
+    _cleanups.clear();
+    _current = 0;
+    _used = 0;
+}
+
+
+size_t Arena::used() const {
+    size_t used = _used;
+    for (size_t index = 0; index < _current && index < _blocks.size();
+         ++index) {
+        used += _blocks[index].size;
+    }
+    return used;
+}
+
+
+size_t Arena::reserved() const {
+    size_t reserved = 0;
+    for (const Block& block : _blocks) { reserved += block.size; }
+    return reserved;
+}
+
+
+
+void ArenaPool::Return::operator () (Arena* arena) const {
+    arena->release();
+    std::lock_guard lock(pool->_mutex);
+    pool->_free.emplace_back(arena);
+}
+
+
+ArenaPool::Lease ArenaPool::acquire() {
+    std::unique_ptr<Arena> arena;
+    {
+        std::lock_guard lock(_mutex);
+        if (!_free.empty()) {
+            arena = std::move(_free.back());
+            _free.pop_back();
+        }
+    }
+    if (!arena) { arena = std::make_unique<Arena>(_block_size); }
+    return Lease(arena.release(), Return{this});
+}
+
+
+size_t ArenaPool::idle() {
+    std::lock_guard lock(_mutex);
+    return _free.size();
+}
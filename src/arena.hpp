@@ -0,0 +1,97 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+namespace parselib {
+
+/*
+ * Monotonic allocator for syntax trees. Objects are bump-allocated from
+ * blocks and are never freed one by one; release() runs the pending
+ * destructors in reverse order of construction and rewinds the arena,
+ * keeping its blocks for the next parse. An object larger than a block
+ * gets a block of its own, which later parses reuse for objects as large.
+ * Nodes made in an arena must not delete their children.
+ */
+class Arena {
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        size_t size;
+    };
+
+    struct Cleanup {
+        void (*destroy)(void*);
+        void* object;
+    };
+
+    std::vector<Block> _blocks;
+    std::vector<Cleanup> _cleanups;
+    size_t _block_size;
+    size_t _current = 0;    // block being filled
+    size_t _used = 0;       // bytes taken from it
+
+public:
+    static constexpr size_t default_block = size_t(64) << 10;
+
+    explicit Arena(size_t block_size=default_block);
+    Arena(const Arena&) = delete;
+    Arena(Arena&&) noexcept = default;
+    Arena& operator = (const Arena&) = delete;
+    Arena& operator = (Arena&&) = delete;
+    ~Arena();
+
+    // `alignment` is any power of two, over-aligned types included
+    void* allocate(size_t size, size_t alignment=alignof(std::max_align_t));
+
+    template <typename T, typename ... Args> T* make(Args&& ... args) {
+        T* object = new (allocate(sizeof(T), alignof(T)))
+            T(std::forward<Args>(args)...);
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            _cleanups.push_back({
+                [](void* object) { static_cast<T*>(object)->~T(); }, object
+            });
+        }
+        return object;
+    }
+
+    void release();
+
+    // bytes handed out since the last release
+    size_t used() const;
+    // bytes held in blocks
+    size_t reserved() const;
+};
+
+
+
+/*
+ * Arenas shared between parses, possibly on several threads. A lease
+ * releases its arena and hands it back to the pool when destroyed.
+ */
+class ArenaPool {
+public:
+    struct Return {
+        ArenaPool* pool = nullptr;
+        void operator () (Arena*) const;
+    };
+    using Lease = std::unique_ptr<Arena, Return>;
+
+private:
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<Arena>> _free;
+    size_t _block_size;
+
+public:
+    explicit ArenaPool(size_t block_size=Arena::default_block)
+        : _block_size(block_size)
+    {}
+
+    Lease acquire();
+    size_t idle();
+};
+
+}
@@ -0,0 +1,156 @@
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <algorithm>
+
+#include "batch.hpp"
+
+using namespace parselib;
+
+
+
+namespace {
+
+/*
+ * The documents [begin, end) left to a worker, packed into one word so
+ * that the owner taking from the front and thieves splitting off the back
+ * agree through a single compare and swap.
+ */
+class Range {
+    std::atomic<uint64_t> _range{0};
+
+    static uint64_t pack(uint32_t begin, uint32_t end) {
+        return uint64_t(begin) << 32 | end;
+    }
+
+public:
+    static uint32_t begin(uint64_t range) { return range >> 32; }
+    static uint32_t end(uint64_t range) { return uint32_t(range); }
+    static uint32_t size(uint64_t range) {
+        return begin(range) < end(range) ? end(range) - begin(range) : 0;
+    }
+
+    uint64_t load() const { return _range.load(std::memory_order_acquire); }
+    // only the owner sets its range, and only once it is empty
+    void reset(uint32_t begin, uint32_t end) {
+        _range.store(pack(begin, end), std::memory_order_release);
+    }
+
+    // the owner's side: the next document, false once empty
+    bool take(uint32_t& index) {
+        uint64_t range = load();
+        while (size(range) != 0) {
+            if (_range.compare_exchange_weak(
+                    range, pack(begin(range) + 1, end(range)),
+                    std::memory_order_acq_rel)) {
+                index = begin(range);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // a thief's side: moves the back half of `range` to [from, to)
+    bool split(uint64_t range, uint32_t& from, uint32_t& to) {
+        const uint32_t middle = begin(range) + size(range) / 2;
+        if (!_range.compare_exchange_strong(
+                range, pack(begin(range), middle),
+                std::memory_order_acq_rel)) {
+            return false;
+        }
+        from = middle;
+        to = end(range);
+        return true;
+    }
+};
+
+}
+
+
+Batch::Batch(const Lexer& lexer, const Driver& driver, unsigned threads)
+    : _lexer(lexer)
+    , _driver(driver)
+    , _threads(threads == 0 ? std::thread::hardware_concurrency() : threads)
+{
+    _threads = std::max(_threads, 1u);
+}
+
+
+std::vector<Parsed> Batch::parse(
+    const std::vector<std::string_view>& inputs) const {
+    std::vector<Parsed> results(inputs.size());
+    const uint32_t count = inputs.size();
+    const unsigned threads = std::max<unsigned>(
+        std::min<uint64_t>(_threads, count), 1);
+    if (threads == 1) {
+        Session session;
+        for (uint32_t index = 0; index < count; ++index) {
+            parse(inputs[index], session, results[index]);
+        }
+        return results;
+    }
+
+    const std::unique_ptr<Range[]> ranges(new Range[threads]);
+    for (unsigned worker = 0; worker < threads; ++worker) {
+        ranges[worker].reset(uint64_t(count) * worker / threads,
+                             uint64_t(count) * (worker + 1) / threads);
+    }
+
+    // true once this worker owns more documents, false when none are left
+    const auto steal = [&ranges, threads](unsigned thief) {
+        for (;;) {
+            unsigned victim = thief;
+            uint64_t largest = 0;
+            for (unsigned worker = 0; worker < threads; ++worker) {
+                const uint64_t range = ranges[worker].load();
+                if (Range::size(range) > Range::size(largest)) {
+                    victim = worker;
+                    largest = range;
+                }
+            }
+            if (Range::size(largest) == 0) return false;
+
+            uint32_t from = 0, to = 0;
+            if (ranges[victim].split(largest, from, to)) {
+                ranges[thief].reset(from, to);
+                return true;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned worker = 0; worker < threads; ++worker) {
+        workers.emplace_back([&, worker] {
+            Session session;
+            uint32_t index = 0;
+            do {
+                while (ranges[worker].take(index)) {
+                    parse(inputs[index], session, results[index]);
+                }
+            } while (steal(worker));
+        });
+    }
+    for (std::thread& worker : workers) { worker.join(); }
+    return results;
+}
+
+
+void Batch::parse(std::string_view input, Session& session,
+                  Parsed& out) const {
+    try {
+        // malformed documents are common enough not to pay for a throw
+        if (!_lexer.tokenize(input, out.tokens, out.failure)) {
+            out.accept = false;
+            out.tree.clear();
+            out.position = out.failure.token;
+            return;
+        }
+        out.accept = _driver.parse(session, out.tokens, out.tree);
+        out.position = out.tokens.empty() ? 0 : session.finish().position;
+        if (!out.accept) { out.failure = session.failure(); }
+    } catch (...) {
+        out.accept = false;
+        out.tree.clear();
+        out.error = std::current_exception();
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <iterator>
+#include <exception>
+#include <string_view>
+
+#include "flat.hpp"
+#include "lexer.hpp"
+#include "parsers.hpp"
+
+namespace parselib {
+
+// The outcome of one document of a batch.
+struct Parsed {
+    bool accept = false;
+    TokenStream tokens;         // views into the document
+    FlatTree tree;              // empty unless accepted
+    uint32_t position = 0;      // token the parse stopped at
+    Failure failure;            // why it was rejected, unless by a throw
+    std::exception_ptr error;   // thrown by an action or a std::regex rule
+};
+
+
+/*
+ * Lexes and parses many documents on a pool of threads sharing one Lexer
+ * and one Driver. Every worker starts with a contiguous range of the
+ * documents and takes them from its front; a worker that runs dry steals
+ * the back half of the largest range left, so a few large documents don't
+ * leave the other cores idle. Each worker keeps one Session, with its
+ * packrat table and tree builder, for all the documents it parses.
+ */
+class Batch {
+    const Lexer& _lexer;
+    const Driver& _driver;
+    unsigned _threads;
+
+public:
+    // 0 threads - one per core; the lexer and driver must outlive the batch
+    Batch(const Lexer&, const Driver&, unsigned threads=0);
+
+    // Results come in input order; their tokens view the inputs, which
+    // must stay alive as long as the results are used
+    std::vector<Parsed> parse(const std::vector<std::string_view>&) const;
+    template <typename Range>
+    std::vector<Parsed> parse(const Range& inputs) const {
+        return parse(std::vector<std::string_view>(std::begin(inputs),
+                                                   std::end(inputs)));
+    }
+
+    unsigned threads() const { return _threads; }
+
+private:
+    void parse(std::string_view, Session&, Parsed&) const;
+};
+
+}
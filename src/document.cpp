@@ -0,0 +1,62 @@
+#include <stdexcept>
+#include <algorithm>
+
+#include "document.hpp"
+
+using namespace parselib;
+
+
+
+Document::Document(const Lexer& lexer, const Parser& parser, std::string text)
+    : _lexer(lexer)
+    , _driver(parser)
+    , _text(std::move(text))
+{
+    _lexer.tokenize(_text, _tokens);
+    _damage = Damage{0, 0, static_cast<uint32_t>(_tokens.size())};
+    parse();
+}
+
+
+bool Document::edit(size_t offset, size_t removed, std::string_view inserted) {
+    if (offset > _text.length()) {
+        throw std::out_of_range("Document edit past the end of the text");
+    }
+    removed = std::min(removed, _text.length() - offset);
+    // lexes the edited copy first, so that an edit which doesn't lex
+    // leaves the document as it was
+    std::string text;
+    text.reserve(_text.length() - removed + inserted.length());
+    text.append(_text, 0, offset).append(inserted)
+        .append(_text, offset + removed);
+    const uint32_t size = _tokens.size();
+    const Damage damage = _lexer.relex(text, _tokens, offset, removed,
+                                       inserted.length());
+    _text.swap(text);
+    _tokens.view(_text);
+    if (_accept) {
+        _damage = damage;
+        _base = size;
+        return parse();
+    }
+
+    // the last good tree is older, widen its damage by this edit
+    const int64_t shift = int64_t(_damage.count) -
+                          int64_t(_damage.end - _damage.begin);
+    const uint32_t begin = std::min(_damage.begin, damage.begin);
+    uint32_t end = _damage.end;
+    if (damage.end > _damage.begin + _damage.count) {
+        end = std::max<uint32_t>(end, damage.end - shift);
+    }
+    _damage = Damage{begin, end, static_cast<uint32_t>(
+        _tokens.size() - (_base - (end - begin)))};
+    return parse();
+}
+
+
+bool Document::parse() {
+    const Reuse reuse(_tree, _damage.begin, _damage.end, _damage.count);
+    _accept = _driver.parse(_tokens, _scratch, reuse);
+    if (_accept) { std::swap(_tree, _scratch); }
+    return _accept;
+}
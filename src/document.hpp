@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <string_view>
+
+#include "flat.hpp"
+#include "lexer.hpp"
+#include "parsers.hpp"
+
+namespace parselib {
+
+/*
+ * A text kept lexed and parsed across edits, for editors. An edit lexes
+ * only the damaged region again, and the parse copies every subtree whose
+ * parse read no damaged token, so its cost follows the size of the edit
+ * and the depth of the tree rather than the length of the text.
+ *
+ * Only the flat tree is kept up to date: actions don't run for copied
+ * subtrees. While the text doesn't parse, tree() stays the last good one.
+ */
+class Document {
+    const Lexer& _lexer;
+    Driver _driver;
+    std::string _text;
+    TokenStream _tokens;
+    FlatTree _tree;
+    FlatTree _scratch;
+    // tokens changed since the stream of `_tree`, which had `_base` tokens
+    Damage _damage;
+    uint32_t _base = 0;
+    bool _accept = false;
+
+public:
+    // the lexer must outlive the document
+    Document(const Lexer&, const Parser&, std::string text="");
+    Document(const Document&) = delete;
+    Document& operator = (const Document&) = delete;
+
+    // Replaces `removed` bytes at `offset` with `inserted`, true if the
+    // new text parses. Throws UnexpectedLexem and changes nothing if the
+    // new text doesn't lex.
+    bool edit(size_t offset, size_t removed, std::string_view inserted)
+        noexcept(false);
+
+    const std::string& text() const { return _text; }
+    const TokenStream& tokens() const { return _tokens; }
+    const FlatTree& tree() const { return _tree; }
+    bool accept() const { return _accept; }
+    const Damage& damage() const { return _damage; }
+
+private:
+    bool parse();
+};
+
+}
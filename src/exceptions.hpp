@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 
 namespace error {
 
@@ -18,8 +19,20 @@ public:
 namespace lexical {
 
 class UnexpectedLexem : public Error {
+    uint64_t _offset;
+
+public:
+    UnexpectedLexem(const std::string& msg, uint64_t offset=0)
+        : Error(msg), _offset(offset) {}
+
+    // where in the input no rule matched
+    uint64_t offset() const { return _offset; }
+};
+
+
+class Overflow : public Error {
 public:
-    UnexpectedLexem(const std::string& msg) : Error(msg) {}
+    Overflow(const std::string& msg) : Error(msg) {}
 };
 
 }
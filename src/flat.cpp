@@ -0,0 +1,118 @@
+#include <algorithm>
+
+#include "flat.hpp"
+
+using namespace parselib;
+
+
+
+uint32_t FlatTree::open(uint32_t kind, uint32_t position, uint32_t rule) {
+    _nodes.push_back(Node{kind, position, position, _cursor});
+    _nodes.back().rule = rule;
+    _cursor = _nodes.size() - 1;
+    return _cursor;
+}
+
+
+void FlatTree::close(uint32_t node, uint32_t position, uint32_t reach) {
+    _nodes[node].end = position;
+    _nodes[node].reach = std::max(position, reach);
+    _cursor = _nodes[node].parent;
+}
+
+
+uint32_t FlatTree::graft(const FlatTree& from, uint32_t node, int64_t shift) {
+    const uint32_t base = _nodes.size();
+    const uint32_t last = from.subtree_end(node);
+    _nodes.insert(_nodes.end(), from._nodes.begin() + node,
+                  from._nodes.begin() + last);
+    for (uint32_t index = base; index < _nodes.size(); ++index) {
+        Node& copy = _nodes[index];
+        copy.parent = index == base ? _cursor : copy.parent - node + base;
+        copy.first_child = copy.next_sibling = none;
+        copy.begin += shift;
+        copy.end += shift;
+        copy.reach += shift;
+    }
+    return base;
+}
+
+
+uint32_t FlatTree::subtree_end(uint32_t node) const {
+    for (; node != none; node = _nodes[node].parent) {
+        if (_nodes[node].next_sibling != none) {
+            return _nodes[node].next_sibling;
+        }
+    }
+    return _nodes.size();
+}
+
+
+void FlatTree::discard(uint32_t node) {
+    _cursor = _nodes[node].parent;
+    _nodes.resize(node);
+}
+
+
+void FlatTree::finalize() {
+    // last child seen so far per parent, the top level is kept aside
+    std::vector<uint32_t> last(_nodes.size(), none);
+    uint32_t last_top = none;
+    for (uint32_t index = 0; index < _nodes.size(); ++index) {
+        Node& node = _nodes[index];
+        node.first_child = node.next_sibling = none;
+        uint32_t& previous = node.parent == none ? last_top
+                                                 : last[node.parent];
+        if (previous != none) {
+            _nodes[previous].next_sibling = index;
+        } else if (node.parent != none) {
+            _nodes[node.parent].first_child = index;
+        }
+        previous = index;
+    }
+}
+
+
+void FlatTree::clear() {
+    _nodes.clear();
+    _cursor = none;
+}
+
+
+
+uint32_t Reuse::graft(uint32_t rule, uint32_t position, FlatTree& into) const {
+    // the position the node would have had before the edit
+    uint32_t old = position;
+    if (position >= _end + _shift) {
+        old = position - _shift;
+    } else if (position >= _begin) {
+        return FlatTree::none;
+    }
+
+    // lookups mostly move forward a little, so gallop from the last one
+    const auto before = [old](const FlatTree::Node& node) {
+        return node.begin < old;
+    };
+    size_t low = 0, high = _tree.size();
+    if (_hint < high && _tree[_hint].begin < old) {
+        low = _hint;
+        for (size_t step = 1; low + step < high; step *= 2) {
+            if (!before(_tree[low + step])) {
+                high = low + step;
+                break;
+            }
+            low += step;
+        }
+    }
+    auto node = std::partition_point(_tree.begin() + low,
+                                     _tree.begin() + high, before);
+    _hint = node - _tree.begin();
+    for (; node != _tree.end() && node->begin == old; ++node) {
+        if (node->rule != rule) continue;
+        if (node->reach > _begin && node->begin < _end) continue;
+
+        into.graft(_tree, _tree.index(*node), shift(*node));
+        return _tree.index(*node);
+    }
+    return FlatTree::none;
+}
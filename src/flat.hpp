@@ -0,0 +1,182 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+
+namespace parselib {
+
+/*
+ * Syntax tree kept in one array in pre-order. Every node records its kind,
+ * the range of tokens it covers, its parent, first child and next sibling
+ * as indices, and a payload index the grammar's actions may set. Walking
+ * the array front to back is a pre-order traversal, so most passes are a
+ * plain loop; visit() adds the leave events without virtual calls.
+ *
+ * The tree is filled by Driver::parse from Parsers that have a kind.
+ * Children and siblings are linked by finalize() once the parse succeeds.
+ * Nodes also remember the Parser that built them and how far its parse
+ * looked ahead, so that a parse after an edit can copy what the edit did
+ * not touch, see Reuse.
+ */
+class FlatTree {
+public:
+    static constexpr uint32_t none = UINT32_MAX;
+
+    struct Node {
+        uint32_t kind;
+        uint32_t begin;     // first token
+        uint32_t end;       // one past the last token
+        uint32_t parent = none;
+        uint32_t first_child = none;
+        uint32_t next_sibling = none;
+        uint32_t payload = none;
+        uint32_t rule = none;   // id of the Parser that built it
+        uint32_t reach = 0;     // one past the last token its parse read
+    };
+
+    class ChildIterator {
+        const FlatTree* _tree = nullptr;
+        uint32_t _index = none;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Node;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Node*;
+        using reference = const Node&;
+
+        ChildIterator() = default;
+        ChildIterator(const FlatTree* tree, uint32_t index)
+            : _tree(tree), _index(index)
+        {}
+
+        reference operator * () const { return (*_tree)[_index]; }
+        pointer operator -> () const { return &(*_tree)[_index]; }
+        uint32_t index() const { return _index; }
+
+        ChildIterator& operator ++ () {
+            _index = (*_tree)[_index].next_sibling;
+            return *this;
+        }
+        ChildIterator operator ++ (int) {
+            ChildIterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator == (const ChildIterator& other) const {
+            return _index == other._index;
+        }
+    };
+
+    struct Children {
+        ChildIterator first;
+        ChildIterator last;
+
+        ChildIterator begin() const { return first; }
+        ChildIterator end() const { return last; }
+    };
+
+private:
+    std::vector<Node> _nodes;
+    uint32_t _cursor = none;
+
+public:
+    FlatTree() = default;
+
+    // opens a node at token `position` under the open one, returns its index
+    uint32_t open(uint32_t kind, uint32_t position, uint32_t rule=none);
+    // completes an open node that ends before token `position`
+    void close(uint32_t node, uint32_t position, uint32_t reach=0);
+    // Copies the subtree of `node` from a finalized tree under the open
+    // node, moving its tokens by `shift`; returns the copy's index
+    uint32_t graft(const FlatTree& from, uint32_t node, int64_t shift);
+    // drops an open node together with everything built inside it
+    void discard(uint32_t node);
+    // drops the closed nodes from `size` on, used on backtracking
+    void truncate(size_t size) { _nodes.resize(size); }
+    // Sets the payload of the innermost open node. Does nothing when no
+    // node is open, as for actions of Parsers without a kind at the top.
+    void payload(uint32_t value) {
+        if (_cursor != none) { _nodes[_cursor].payload = value; }
+    }
+    void finalize();
+    void clear();
+
+    size_t size() const { return _nodes.size(); }
+    bool empty() const { return _nodes.empty(); }
+    const Node& operator [] (size_t index) const { return _nodes[index]; }
+    uint32_t index(const Node& node) const { return &node - _nodes.data(); }
+    // one past the last node of the subtree of `node`, once finalized
+    uint32_t subtree_end(uint32_t node) const;
+
+    std::vector<Node>::const_iterator begin() const { return _nodes.begin(); }
+    std::vector<Node>::const_iterator end() const { return _nodes.end(); }
+
+    // top level nodes when `node` is none
+    Children children(uint32_t node) const {
+        const uint32_t first = node == none ? (empty() ? none : 0)
+                                            : _nodes[node].first_child;
+        return {ChildIterator(this, first), ChildIterator(this, none)};
+    }
+
+    // Calls visitor.enter(node) in pre-order and, if the visitor has one,
+    // visitor.leave(node) once the node's subtree is done.
+    template <typename Visitor> void visit(Visitor&& visitor) const {
+        uint32_t previous = none;
+        for (const Node& node : _nodes) {
+            leave(visitor, previous, node.parent);
+            visitor.enter(node);
+            previous = index(node);
+        }
+        leave(visitor, previous, none);
+    }
+
+private:
+    template <typename Visitor>
+    void leave(Visitor& visitor, uint32_t from, uint32_t to) const {
+        for (; from != to; from = _nodes[from].parent) {
+            if constexpr (requires { visitor.leave(_nodes[from]); }) {
+                visitor.leave(_nodes[from]);
+            }
+        }
+    }
+};
+
+
+
+/*
+ * The subtrees of a tree parsed before an edit that are still valid after
+ * it. Tokens [begin, end) of the old stream were replaced by `count` new
+ * ones; a subtree survives if its parse read only tokens before them, or
+ * started after them. Parsers look it up by their id and position and copy
+ * the subtree instead of parsing again.
+ */
+class Reuse {
+    const FlatTree& _tree;
+    uint32_t _begin;
+    uint32_t _end;
+    int64_t _shift;
+    mutable uint32_t _hint = 0;
+
+public:
+    Reuse(const FlatTree& tree, uint32_t begin, uint32_t end, uint32_t count)
+        : _tree(tree)
+        , _begin(begin)
+        , _end(end)
+        , _shift(int64_t(count) - int64_t(end - begin))
+    {}
+
+    // Grafts the node `rule` built at new token `position` into `into`,
+    // returns the node's index in the old tree or none
+    uint32_t graft(uint32_t rule, uint32_t position, FlatTree& into) const;
+    // the shift applied to an old node
+    int64_t shift(const FlatTree::Node& node) const {
+        return node.begin >= _end ? _shift : 0;
+    }
+    const FlatTree& tree() const { return _tree; }
+};
+
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "language.hpp"
 using namespace parselib;
 
@@ -25,3 +27,99 @@ void SyntaxTree::pop(AST* subtree) {
         _root->pop(subtree);
     }
 }
+
+
+
+void TreeBuilder::append(AST* node) {
+    AST* cursor = _tree.cursor();
+    AST* parent = cursor ? cursor : _tree.root();
+    _log.push_back({Step::Append, node, parent, cursor});
+    if (parent) {
+        node->parent(parent);
+        parent->append(node);
+    } else {
+        node->parent(nullptr);
+        _tree = SyntaxTree(node);
+        _tree.cursor(cursor);
+    }
+}
+
+
+void TreeBuilder::open(AST* node) {
+    append(node);
+    _tree.cursor(node);
+}
+
+
+void TreeBuilder::close() {
+    AST* cursor = _tree.cursor();
+    _log.push_back({Step::Close, nullptr, nullptr, cursor});
+    _tree.cursor(cursor ? cursor->parent() : nullptr);
+}
+
+
+void TreeBuilder::adopt(Mark mark) {
+    AST* node = _tree.cursor();
+    AST* parent = node ? node->parent() : nullptr;
+    if (!parent) return;
+
+    std::vector<AST*> moved;
+    for (size_t index = mark.log; index < _log.size(); ++index) {
+        const Step& step = _log[index];
+        if (step.parent != parent || step.node == node) continue;
+        if (step.kind == Step::Append || step.kind == Step::Attach) {
+            moved.push_back(step.node);
+        } else if (step.kind == Step::Detach) {
+            std::erase(moved, step.node);
+        }
+    }
+
+    // detached last to first, so rolling back restores the order
+    for (auto child = moved.rbegin(); child != moved.rend(); ++child) {
+        parent->pop(*child);
+        _log.push_back({Step::Detach, *child, parent, node});
+    }
+    for (AST* child : moved) {
+        child->parent(node);
+        node->append(child);
+        _log.push_back({Step::Attach, child, node, node});
+    }
+}
+
+
+void TreeBuilder::rollback(Mark mark) {
+    if (_flat) { _flat->truncate(mark.flat); }
+    while (_log.size() > mark.log) {
+        const Step step = _log.back();
+        _log.pop_back();
+        switch (step.kind) {
+        case Step::Append:
+            if (step.parent) {
+                step.parent->pop(step.node);
+            } else {
+                _tree = SyntaxTree(nullptr);
+            }
+            if (!_arena) { delete step.node; }
+            break;
+        case Step::Attach:
+            step.parent->pop(step.node);
+            break;
+        case Step::Detach:
+            step.node->parent(step.parent);
+            step.parent->append(step.node);
+            break;
+        case Step::Close:
+            break;
+        }
+        _tree.cursor(step.cursor);
+    }
+}
+
+
+void TreeBuilder::reset(AST* root, Arena* arena, FlatTree* flat) {
+    _tree = SyntaxTree(root);
+    _log.clear();
+    _arena = arena;
+    _flat = flat;
+    if (_flat) { _flat->clear(); }
+}
@@ -1,5 +1,13 @@
 #pragma once
 
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+#include "flat.hpp"
+#include "arena.hpp"
+
 namespace parselib {
 
 class Visitor;
@@ -34,8 +42,67 @@ public:
     void pop(AST*) override;
     void accept(Visitor*) const override;
 
+    AST* root() const { return _root; }
     AST* cursor() const { return _cursor; }
     void cursor(AST* cursor) { _cursor = cursor; }
 };
 
+
+
+/*
+ * Builds a SyntaxTree while parsing and records every step in an undo log.
+ * A mark is a position in that log; rolling back to it pops and deletes the
+ * nodes appended since and restores the cursor, which is how failed
+ * alternatives are discarded. A node appended without an open node becomes
+ * the root when there is none yet, otherwise it goes under the root.
+ *
+ * Nodes come from the arena given to reset(), or from the heap without one;
+ * rolled back nodes are left to the arena. A FlatTree given to reset() is
+ * truncated on rollback as well.
+ */
+class TreeBuilder {
+    struct Step {
+        enum Kind : uint8_t { Append, Close, Detach, Attach } kind;
+        AST* node;
+        AST* parent;    // the node was attached to or detached from it
+        AST* cursor;    // cursor before the step
+    };
+
+    SyntaxTree _tree;
+    std::vector<Step> _log;
+    Arena* _arena = nullptr;
+    FlatTree* _flat = nullptr;
+
+public:
+    struct Mark {
+        size_t log = 0;
+        size_t flat = 0;
+    };
+
+    TreeBuilder(AST* root=nullptr) : _tree(root) {}
+
+    // appends a leaf under the cursor
+    void append(AST*);
+    // appends a node under the cursor and moves the cursor into it
+    void open(AST*);
+    // moves the cursor back to the parent of the current node
+    void close();
+    // moves the nodes appended next to the cursor node since `mark` into
+    // it, so an operator node can take the operand parsed before it
+    void adopt(Mark mark);
+
+    Mark mark() const { return {_log.size(), _flat ? _flat->size() : 0}; }
+    void rollback(Mark);
+    void reset(AST* root, Arena* arena=nullptr, FlatTree* flat=nullptr);
+
+    template <typename T, typename ... Args> T* make(Args&& ... args) {
+        if (_arena) return _arena->make<T>(std::forward<Args>(args)...);
+        return new T(std::forward<Args>(args)...);
+    }
+
+    const SyntaxTree& tree() const { return _tree; }
+    AST* cursor() const { return _tree.cursor(); }
+    FlatTree* flat() const { return _flat; }
+};
+
 }
@@ -1,13 +1,30 @@
+#include <thread>
 #include <iostream>
+#include <algorithm>
 
 #include "exceptions.hpp"
 #include "constants.hpp"
 #include "lexer.hpp"
+#include "profile.hpp"
 
 using namespace parselib;
 
 
 
+[[noreturn]] static void unexpected(uint64_t offset) {
+    throw error::lexical::UnexpectedLexem(
+        "UnexpectedLexem at offset " + std::to_string(offset), offset);
+}
+
+
+// The rule's own automaton, for patterns it matches exactly as the regex
+static std::shared_ptr<const Scanner> automaton(const std::string& pattern) {
+    auto scanner = std::make_shared<const Scanner>(
+        std::vector<std::string>{pattern});
+    return scanner->supports(0) ? scanner : nullptr;
+}
+
+
 Rule::Rule()
     : pattern(::constants::empty<std::string>())
     , regex(::constants::empty<std::string>())
@@ -16,11 +33,27 @@ Rule::Rule()
 {}
 
 
-Rule::Rule(const std::string& pattern, uint32_t tag, bool ignorable) :
-    pattern(pattern), regex(pattern), tag(tag), ignorable(ignorable) {}
+Rule::Rule(const std::string& pattern, uint32_t tag, bool ignorable)
+    : pattern(pattern)
+    , regex(pattern)
+    , scanner(automaton(pattern))
+    , tag(tag)
+    , ignorable(ignorable)
+{}
+
+Rule::Rule(const char* pattern, uint32_t tag, bool ignorable)
+    : Rule(std::string(pattern), tag, ignorable)
+{}
+
 
-Rule::Rule(const char* pattern, uint32_t tag, bool ignorable) :
-    pattern(pattern), regex(pattern), tag(tag), ignorable(ignorable) {}
+Rule Rule::precompiled(const std::string& pattern, uint32_t tag,
+                       bool ignorable) {
+    Rule rule{Bare{}};
+    rule.pattern = pattern;
+    rule.tag = tag;
+    rule.ignorable = ignorable;
+    return rule;
+}
 
 MatchObject Rule::match(const std::string& input, const uint64_t pos) const {
     CSIterator begin = input.cbegin(), end = input.cend();
@@ -30,9 +63,30 @@ MatchObject Rule::match(const std::string& input, const uint64_t pos) const {
 
 
 MatchObject Rule::match(CSIterator begin, CSIterator end) const {
+    // match_continuous stops the search from sliding past the first position
     MatchObject matchObject;
-    const bool result = std::regex_search(begin, end, matchObject, regex);
-    return result && matchObject.position() == 0 ? matchObject : MatchObject();
+    const bool result = std::regex_search(begin, end, matchObject, regex,
+        std::regex_constants::match_continuous);
+    return result ? matchObject : MatchObject();
+}
+
+
+uint64_t Rule::matchAt(const std::string& input, uint64_t pos) const {
+    return pos >= input.length() ? npos :
+        matchAt(input.data() + pos, input.data() + input.length());
+}
+
+
+uint64_t Rule::matchAt(const char* begin, const char* end) const {
+    if (scanner) {
+        const Scanner::Match found = scanner->scan(begin, end, Priority::First);
+        return found.empty() ? npos : found.length;
+    }
+
+    std::match_results<const char*> matchObject;
+    const bool result = std::regex_search(begin, end, matchObject, regex,
+        std::regex_constants::match_continuous);
+    return result && matchObject.length(0) > 0 ? matchObject.length(0) : npos;
 }
 
 
@@ -67,38 +121,404 @@ bool Lexem::empty() const {
 
 
 
-Lexer::Lexer(const Rules& rules) : _rules(rules), _position(0) {}
+static std::vector<std::string> patterns(const Rules& rules) {
+    std::vector<std::string> out;
+    out.reserve(rules.size());
+    for (const Rule& rule: rules) {
+        out.push_back(rule.pattern);
+    }
+    return out;
+}
+
+
+static Scanner automaton(const Rules& rules) {
+    Scanner scanner(patterns(rules));
+    if (!scanner.empty()) return scanner;
+
+    // too large as a whole, so literals go to the trie and leave the
+    // automaton to the rest
+    std::vector<bool> literals(rules.size(), false);
+    std::string text;
+    for (size_t index = 0; index < rules.size(); ++index) {
+        literals[index] = Literals::literal(rules[index].pattern, text);
+    }
+    if (std::find(literals.begin(), literals.end(), true) == literals.end()) {
+        return scanner;
+    }
+    return Scanner(patterns(rules), literals);
+}
+
+
+static Literals trie(const Rules& rules, const Scanner& scanner) {
+    std::vector<std::pair<uint32_t, std::string>> out;
+    std::string text;
+    for (uint32_t index = 0; index < rules.size(); ++index) {
+        if (!scanner.supports(index) &&
+            Literals::literal(rules[index].pattern, text)) {
+            out.emplace_back(index, text);
+        }
+    }
+    return Literals(out);
+}
+
+
+static std::vector<uint32_t> fallback(const Scanner& scanner,
+                                      const Literals& literals,
+                                      size_t count) {
+    std::vector<uint32_t> out;
+    for (uint32_t index = 0; index < count; ++index) {
+        if (!scanner.supports(index) && !literals.contains(index)) {
+            out.push_back(index);
+        }
+    }
+    return out;
+}
+
+
+Lexer::Lexer(Rules rules, Priority priority)
+    : _rules(std::move(rules))
+    , _priority(priority)
+    , _scanner(automaton(_rules))
+    , _literals(trie(_rules, _scanner))
+    , _fallback(fallback(_scanner, _literals, _rules.size()))
+{}
+
+
+Lexer::Lexer(Rules rules, Scanner scanner, Priority priority)
+    : _rules(std::move(rules))
+    , _priority(priority)
+    , _scanner(std::move(scanner))
+    , _literals(trie(_rules, _scanner))
+    , _fallback(fallback(_scanner, _literals, _rules.size()))
+{}
 
 
-std::vector<Lexem> Lexer::tokenize(const std::string& input) {
+std::vector<Lexem> Lexer::tokenize(const std::string& input) const {
     const uint64_t length = input.length();
     std::vector<Lexem> out;
-    while (_position < length) {
-        Lexem lexem = findLexem(input);
+    uint64_t position = 0;
+    while (position < length) {
+        Lexem lexem = findLexem(input, position);
         if (!lexem.empty()) {
             out.push_back(lexem);
         }
     }
-    _position = 0;
     return out;
 }
 
 
-Lexem Lexer::findLexem(const std::string& input) {
-    for (const Rule& rule: _rules) {
-        MatchObject result = rule.match(input, _position);
-        if (!result.empty()) {
-            std::string content = result.str();
-            const uint64_t start = _position;
-            _position += content.length();
-            return rule.ignorable ? Lexem() : Lexem(content, start, rule.tag);
+Lexem Lexer::findLexem(const std::string& input, uint64_t& position) const {
+    const char* data = input.data();
+    const Scanner::Match found = match(data + position, data + input.length());
+    if (!found.empty()) {
+        const Rule& rule = _rules[found.pattern];
+        const uint64_t start = position;
+        position += found.length;
+        return rule.ignorable ? Lexem() :
+            Lexem(input.substr(start, found.length), start, rule.tag);
+    }
+    unexpected(position);
+}
+
+
+void Lexer::tokenize(std::string_view input, TokenStream& out) const {
+    Failure failure;
+    if (!tokenize(input, out, failure)) { unexpected(failure.offset); }
+}
+
+
+bool Lexer::tokenize(std::string_view input, TokenStream& out,
+                     Failure& failure) const {
+    out.reset(input);
+    const char* begin = input.data();
+    const char* end = begin + input.length();
+    for (const char* current = begin; current != end;) {
+        const Scanner::Match found = match(current, end);
+        if (found.empty()) {
+            failure.offset = current - begin;
+            failure.token = out.size();
+            failure.expected.clear();
+            return false;
+        }
+        const Rule& rule = _rules[found.pattern];
+        if (!rule.ignorable) {
+            out.push(current - begin, found.length, rule.tag);
+        }
+        current += found.length;
+    }
+    return true;
+}
+
+
+namespace {
+
+// inputs below this size per thread are lexed sequentially
+constexpr uint64_t PARALLEL_CHUNK = 1 << 20;
+
+// Every match of one speculative chunk, ignorable ones included, so that
+// the stitching can find the first offset both neighbours agree on.
+struct Piece {
+    uint64_t begin = 0;
+    std::vector<uint32_t> starts;
+    std::vector<uint32_t> lengths;
+    std::vector<uint32_t> rules;
+};
+
+}
+
+
+void Lexer::tokenize(std::string_view input, TokenStream& out,
+                     unsigned threads) const {
+    if (threads == 0) { threads = std::thread::hardware_concurrency(); }
+    const uint64_t length = input.length();
+    threads = static_cast<unsigned>(std::min<uint64_t>(
+        std::max(threads, 1u), std::max<uint64_t>(length / PARALLEL_CHUNK, 1)));
+    if (threads == 1) return tokenize(input, out);
+
+    out.reset(input);
+    const char* data = input.data();
+    const char* end = data + length;
+    std::vector<Piece> pieces(threads);
+    std::vector<std::thread> workers;
+    for (unsigned index = 0; index < threads; ++index) {
+        pieces[index].begin = length * index / threads;
+        const uint64_t last = length * (index + 1) / threads;
+        workers.emplace_back([this, &piece = pieces[index], data, end, last] {
+            try {
+                for (uint64_t at = piece.begin; at < last;) {
+                    const Scanner::Match found = match(data + at, end);
+                    if (found.empty()) break;
+                    const uint64_t size = found.length;
+                    piece.starts.push_back(static_cast<uint32_t>(at));
+                    piece.lengths.push_back(static_cast<uint32_t>(size));
+                    piece.rules.push_back(found.pattern);
+                    at += found.length;
+                }
+            } catch (...) {
+                // a wrong guess may hit anything; the stitching re-lexes it
+            }
+        });
+    }
+    for (std::thread& worker: workers) { worker.join(); }
+
+    // Matches depend only on the offset they start at, so once the true
+    // sequence reaches an offset some chunk also started a match at, the
+    // rest of that chunk is exact.
+    auto emit = [&](uint32_t rule, uint64_t at, uint64_t size) {
+        if (!_rules[rule].ignorable) { out.push(at, size, _rules[rule].tag); }
+    };
+    size_t current = 0;
+    std::vector<bool> used(threads, false);
+    for (uint64_t at = 0; at < length;) {
+        while (current + 1 < threads && pieces[current + 1].begin <= at) {
+            ++current;
+        }
+
+        Piece& piece = pieces[current];
+        auto found = std::lower_bound(piece.starts.begin(), piece.starts.end(),
+                                      static_cast<uint32_t>(at));
+        if (!used[current] && found != piece.starts.end() && *found == at) {
+            used[current] = true;
+            for (size_t index = found - piece.starts.begin();
+                 index < piece.starts.size(); ++index) {
+                emit(piece.rules[index], piece.starts[index],
+                     piece.lengths[index]);
+                at = uint64_t(piece.starts[index]) + piece.lengths[index];
+            }
+            continue;
         }
+
+        const Scanner::Match next = match(data + at, end);
+        if (next.empty()) { unexpected(at); }
+        emit(next.pattern, at, next.length);
+        at += next.length;
+    }
+}
+
+
+Damage Lexer::relex(std::string_view input, TokenStream& tokens,
+                    uint64_t offset, uint64_t removed,
+                    uint64_t inserted) const {
+    const int64_t shift = int64_t(inserted) - int64_t(removed);
+    // the first token that touches the edit, and one before it
+    const uint32_t size = tokens.size();
+    uint32_t first = std::partition_point(
+        tokens.begin(), tokens.end(), [offset](const LexemView& token) {
+            return token.end() < offset;
+        }).index();
+    first = first == 0 ? 0 : first - 1;
+
+    TokenStream fresh(input);
+    uint32_t last = first;
+    const uint64_t edited = offset + inserted;
+    const char* begin = input.data();
+    const char* end = begin + input.length();
+    uint64_t at = first == 0 ? 0 : tokens.offset(first);
+    while (at < input.length()) {
+        if (at >= edited) {
+            // matches depend only on the text from where they start
+            const uint64_t old = at - shift;
+            while (last < size && tokens.offset(last) < old) { ++last; }
+            if (last < size && tokens.offset(last) == old) break;
+        }
+
+        const Scanner::Match found = match(begin + at, end);
+        if (found.empty()) { unexpected(at); }
+        const Rule& rule = _rules[found.pattern];
+        if (!rule.ignorable) { fresh.push(at, found.length, rule.tag); }
+        at += found.length;
     }
-    // TODO: make message more verbose
-    throw error::lexical::UnexpectedLexem("UnexpectedLexem");
+    if (at >= input.length()) { last = size; }
+
+    tokens.splice(first, last, fresh, shift);
+    return Damage{first, last, static_cast<uint32_t>(fresh.size())};
 }
 
 
+Lexems Lexer::tokenize(const std::string& input, unsigned threads) const {
+    TokenStream tokens;
+    tokenize(input, tokens, threads);
+
+    Lexems out;
+    out.reserve(tokens.size());
+    for (size_t index = 0; index < tokens.size(); ++index) {
+        out.emplace_back(std::string(tokens.content(index)),
+                         tokens.offset(index), tokens.tag(index));
+    }
+    return out;
+}
+
+
+LexemStream Lexer::stream(std::istream& input) const {
+    return stream(ChunkSource([&input](std::string& buffer) {
+        const size_t size = buffer.size();
+        buffer.resize(size + LexemStream::chunk);
+        input.read(buffer.data() + size, LexemStream::chunk);
+        buffer.resize(size + input.gcount());
+        return input.gcount() > 0;
+    }));
+}
+
+
+LexemStream Lexer::stream(ChunkSource source) const {
+    return LexemStream(*this, std::move(source));
+}
+
+
+Scanner::Match Lexer::match(const char* begin, const char* end, bool more,
+                            uint64_t window) const {
+    Profile* profile = probe::current();
+    const bool timing = profile && profile->timing();
+    uint64_t clock = timing ? Profile::clock() : 0;
+    // charges the cycles since the last attempt to `rule`
+    const auto attempt = [&](Profile::Rule& rule) {
+        ++rule.attempts;
+        if (!timing) return;
+        const uint64_t now = Profile::clock();
+        rule.cycles += now - clock;
+        clock = now;
+    };
+
+    Scanner::Match best = _scanner.scan(begin, end, _priority);
+    if (!_literals.empty()) {
+        const Scanner::Match literal = _literals.scan(begin, end, _priority);
+        const bool better = _priority == Priority::First
+            ? literal.pattern < best.pattern
+            : !literal.empty() && (literal.length > best.length ||
+              (literal.length == best.length &&
+               literal.pattern < best.pattern));
+        if (better) {
+            best.pattern = literal.pattern;
+            best.length = literal.length;
+        }
+        best.truncated = best.truncated || literal.truncated;
+    }
+    best.truncated = more && best.truncated;
+    const bool starved = more && static_cast<uint64_t>(end - begin) < window;
+    if (profile) {
+        Profile::Rule& automaton = profile->rule(this, Profile::none,
+                                                 "<automaton>");
+        attempt(automaton);
+        automaton.hits += !best.empty();
+        automaton.bytes += best.length;
+    }
+
+    // rules left to std::regex compete with the automaton by priority
+    for (uint32_t index: _fallback) {
+        if (_priority == Priority::First && index >= best.pattern) break;
+
+        best.truncated = best.truncated || starved;
+        const uint64_t length = _rules[index].matchAt(begin, end);
+        if (profile) {
+            attempt(profile->rule(this, index, _rules[index].pattern));
+        }
+        if (length == Rule::npos) continue;
+        if (_priority == Priority::First || length > best.length ||
+            (length == best.length && index < best.pattern)) {
+            best = Scanner::Match{index, length, best.truncated};
+        }
+        if (_priority == Priority::First) break;
+    }
+
+    if (profile && !best.empty() && !best.truncated) {
+        Profile::Rule& rule = profile->rule(this, best.pattern,
+                                            _rules[best.pattern].pattern);
+        rule.automaton = _scanner.supports(best.pattern) ||
+                         _literals.contains(best.pattern);
+        ++rule.hits;
+        rule.bytes += best.length;
+    }
+    return best;
+}
+
+
+LexemStream::LexemStream(const Lexer& lexer, ChunkSource source,
+                         uint64_t window)
+    : _lexer(lexer)
+    , _source(std::move(source))
+    , _window(window)
+{}
+
+
+bool LexemStream::next(Lexem& out) {
+    while (true) {
+        if (_cursor == _buffer.size()) {
+            if (_finished) return false;
+            fill();
+            continue;
+        }
+
+        const char* begin = _buffer.data() + _cursor;
+        const char* end = _buffer.data() + _buffer.size();
+        const Scanner::Match found = _lexer.match(begin, end, !_finished,
+                                                  _window);
+        if (found.truncated) {
+            // the token may continue in the next chunk
+            fill();
+            continue;
+        }
+        if (found.empty()) { unexpected(position()); }
+
+        const Rule& rule = _lexer._rules[found.pattern];
+        const uint64_t start = position();
+        _cursor += found.length;
+        if (!rule.ignorable) {
+            out = Lexem(std::string(begin, found.length), start, rule.tag);
+            return true;
+        }
+    }
+}
+
+
+void LexemStream::fill() {
+    _buffer.erase(0, _cursor);
+    _offset += _cursor;
+    _cursor = 0;
+    _finished = !_source(_buffer);
+}
+
+
+
 std::ostream& parselib::operator << (std::ostream& os, const Lexem& lexem) {
     return os << "[Lexem content: " << "'" << lexem.content << "'"
               << "(" << lexem.start << " - " << lexem.end << ")]";
@@ -114,3 +534,206 @@ std::ostream& parselib::operator << (std::ostream& os, const Lexems& lexems) {
     }
     return length == 0 ? os << "}" : os << lexems[length - 1] << "}";
 }
+
+
+
+TokenSource::TokenSource(const Lexer& lexer, std::string_view input)
+    : _lexer(lexer)
+    , _input(input)
+    , _tokens(input)
+{}
+
+
+bool TokenSource::pull(size_t floor) {
+    if (_failed) return false;
+    // forgetting moves the tokens kept, so it waits until fewer are kept
+    // than dropped
+    const size_t first = _tokens.first();
+    if (floor > first && floor - first >= std::max(_tokens.size() - floor,
+                                                   batch)) {
+        _tokens.forget(floor);
+    }
+
+    const size_t before = _tokens.size();
+    const char* begin = _input.data();
+    const char* end = begin + _input.length();
+    while (_tokens.size() - before < batch && _offset < _input.length()) {
+        const Scanner::Match found = _lexer.match(begin + _offset, end);
+        if (found.empty()) {
+            _failed = true;
+            break;
+        }
+        const Rule& rule = _lexer._rules[found.pattern];
+        if (!rule.ignorable) {
+            _tokens.push(_offset, found.length, rule.tag);
+        }
+        _offset += found.length;
+    }
+    return _tokens.size() != before;
+}
+
+
+
+TokenStream::TokenStream(std::string_view source) : _source(source) {
+    if (source.length() > UINT32_MAX) {
+        throw error::lexical::Overflow("TokenStream input exceeds 4 GiB");
+    }
+}
+
+
+TokenStream::TokenStream(const Lexems& lexems) {
+    // lexer output is ordered and disjoint, so the text is laid out at the
+    // original offsets; anything else is packed one lexem after another
+    bool ordered = true;
+    uint64_t last = 0;
+    for (const Lexem& lexem: lexems) {
+        ordered = ordered && lexem.start >= last &&
+                  lexem.end - lexem.start == lexem.content.length();
+        last = ordered ? lexem.end : last + lexem.content.length();
+    }
+    if (last > UINT32_MAX) {
+        throw error::lexical::Overflow("TokenStream input exceeds 4 GiB");
+    }
+
+    _storage.assign(last, ' ');
+    uint64_t offset = 0;
+    for (const Lexem& lexem: lexems) {
+        offset = ordered ? lexem.start : offset;
+        _storage.replace(offset, lexem.content.length(), lexem.content);
+        _offsets.push_back(static_cast<uint32_t>(offset));
+        _lengths.push_back(static_cast<uint32_t>(lexem.content.length()));
+        if (lexem.tag > UINT16_MAX) {
+            throw error::lexical::Overflow("Lexem tag exceeds 16 bits");
+        }
+        _tags.push_back(static_cast<uint16_t>(lexem.tag));
+        offset += lexem.content.length();
+    }
+    _source = _storage;
+}
+
+
+TokenStream::TokenStream(const TokenStream& old)
+    : _source(old._source)
+    , _storage(old._storage)
+    , _offsets(old._offsets)
+    , _lengths(old._lengths)
+    , _tags(old._tags)
+    , _first(old._first)
+{
+    rebase();
+}
+
+
+TokenStream::TokenStream(TokenStream&& old) noexcept
+    : _source(old._source)
+    , _storage(std::move(old._storage))
+    , _offsets(std::move(old._offsets))
+    , _lengths(std::move(old._lengths))
+    , _tags(std::move(old._tags))
+    , _first(old._first)
+{
+    rebase();
+}
+
+
+TokenStream& TokenStream::operator = (const TokenStream& old) {
+    if (this == &old) return *this;
+
+    _source = old._source;
+    _storage = old._storage;
+    _offsets = old._offsets;
+    _lengths = old._lengths;
+    _tags = old._tags;
+    _first = old._first;
+    rebase();
+    return *this;
+}
+
+
+TokenStream& TokenStream::operator = (TokenStream&& old) noexcept {
+    if (this == &old) return *this;
+
+    _source = old._source;
+    _storage = std::move(old._storage);
+    _offsets = std::move(old._offsets);
+    _lengths = std::move(old._lengths);
+    _tags = std::move(old._tags);
+    _first = old._first;
+    rebase();
+    return *this;
+}
+
+
+void TokenStream::rebase() {
+    // an owning stream must view its own copy of the text
+    if (!_storage.empty()) {
+        _source = _storage;
+    }
+}
+
+
+void TokenStream::reset(std::string_view source) {
+    if (source.length() > UINT32_MAX) {
+        throw error::lexical::Overflow("TokenStream input exceeds 4 GiB");
+    }
+    _storage.clear();
+    _source = source;
+    _offsets.clear();
+    _lengths.clear();
+    _tags.clear();
+    _first = 0;
+}
+
+
+void TokenStream::push(uint64_t offset, uint64_t length, Tag tag) {
+    if (tag > UINT16_MAX) {
+        throw error::lexical::Overflow("Lexem tag exceeds 16 bits");
+    }
+    _offsets.push_back(static_cast<uint32_t>(offset));
+    _lengths.push_back(static_cast<uint32_t>(length));
+    _tags.push_back(static_cast<uint16_t>(tag));
+}
+
+
+void TokenStream::forget(size_t index) {
+    const size_t count = std::min(index, size()) - _first;
+    _offsets.erase(_offsets.begin(), _offsets.begin() + count);
+    _lengths.erase(_lengths.begin(), _lengths.begin() + count);
+    _tags.erase(_tags.begin(), _tags.begin() + count);
+    _first += count;
+}
+
+
+void TokenStream::view(std::string_view source) {
+    _storage.clear();
+    _source = source;
+}
+
+
+void TokenStream::splice(size_t first, size_t last, const TokenStream& tokens,
+                         int64_t shift) {
+    const auto replace = [first, last](auto& column, const auto& with) {
+        column.erase(column.begin() + first, column.begin() + last);
+        column.insert(column.begin() + first, with.begin(), with.end());
+    };
+    for (size_t index = last; index < size(); ++index) {
+        _offsets[index] += shift;
+    }
+    replace(_offsets, tokens._offsets);
+    replace(_lengths, tokens._lengths);
+    replace(_tags, tokens._tags);
+    _storage.clear();
+    _source = tokens._source;
+}
+
+
+std::ostream& parselib::operator << (std::ostream& os,
+                                     const TokenStream& tokens) {
+    os << "{";
+    for (size_t index = tokens.first(); index < tokens.size(); ++index) {
+        os << (index == tokens.first() ? "" : ", ") << "[Lexem content: '"
+           << tokens.content(index) << "'(" << tokens.offset(index) << " - "
+           << tokens.offset(index) + tokens.length(index) << ")]";
+    }
+    return os << "}";
+}
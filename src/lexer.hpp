@@ -2,10 +2,17 @@
 
 #include <vector>
 #include <regex>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <ostream>
+#include <istream>
+#include <iterator>
+#include <functional>
 #include <cstdint>
 
+#include "scanner.hpp"
+
 namespace parselib {
 
 using CSIterator = std::string::const_iterator;
@@ -13,18 +20,35 @@ using CAllocator = std::allocator<std::sub_match<CSIterator>>;
 using MatchObject = std::match_results<CSIterator, CAllocator>;
 
 struct Rule {
+    static constexpr uint64_t npos = UINT64_MAX;
+
     std::string pattern;
     std::regex regex;
+    std::shared_ptr<const Scanner> scanner;
     uint32_t tag;
     bool ignorable;
 
     explicit Rule();
     explicit Rule(const std::string&, uint32_t, bool ignorable=false);
     explicit Rule(const char*, uint32_t, bool ignorable=false);
+    // A rule left to the automaton of a generated Lexer: it compiles no
+    // std::regex or Scanner of its own and matches nothing by itself
+    static Rule precompiled(const std::string&, uint32_t,
+                            bool ignorable=false);
 
     MatchObject match(CSIterator, CSIterator) const;
     MatchObject match(const std::string& input, const uint64_t) const;
+
+    // Length of the non-empty match starting exactly at the given position,
+    // npos otherwise; the match is the one `match` finds. A failed attempt
+    // never reads past the longest prefix the pattern could still extend.
+    uint64_t matchAt(const char*, const char*) const;
+    uint64_t matchAt(const std::string& input, uint64_t) const;
     bool isValid() const;
+
+private:
+    struct Bare {};
+    explicit Rule(Bare) : tag(0), ignorable(false) {}
 };
 using Rules = std::vector<Rule>;
 
@@ -48,17 +72,364 @@ std::ostream& operator << (std::ostream& os, const Lexems& lexems);
 
 
 
+struct LexemView {
+    std::string_view content;
+    uint32_t start;
+    Tag tag;
+
+    uint32_t length() const { return static_cast<uint32_t>(content.length()); }
+    uint32_t end() const { return start + length(); }
+};
+
+
+/*
+ * Tokens kept as views into the lexed buffer: 32-bit offset and length and
+ * a 16-bit tag per token, stored column-wise. The caller keeps the buffer
+ * alive; a stream built from Lexems owns a copy of their text instead.
+ * A stream filled by a TokenSource may have forgotten its first tokens;
+ * indices still count from the start of the input.
+ */
+class TokenStream {
+    std::string_view _source;
+    std::string _storage;
+    std::vector<uint32_t> _offsets;
+    std::vector<uint32_t> _lengths;
+    std::vector<uint16_t> _tags;
+    uint32_t _first = 0;        // index of the first token kept
+
+public:
+    class const_iterator;
+
+    TokenStream() = default;
+    explicit TokenStream(std::string_view source);
+    explicit TokenStream(const Lexems&);
+    TokenStream(const TokenStream&);
+    TokenStream(TokenStream&&) noexcept;
+    TokenStream& operator = (const TokenStream&);
+    TokenStream& operator = (TokenStream&&) noexcept;
+    ~TokenStream() = default;
+
+    // drops the tokens but keeps the allocated columns for reuse
+    void reset(std::string_view source);
+    void push(uint64_t offset, uint64_t length, Tag tag);
+    // Replaces tokens [first, last) with `tokens`, moves the ones after by
+    // `shift` bytes and views the source of `tokens` from now on
+    void splice(size_t first, size_t last, const TokenStream& tokens,
+                int64_t shift);
+    // drops the tokens before `index`, which can't be read from then on
+    void forget(size_t index);
+    // views the tokens in `source`, a copy of the text they were lexed from
+    void view(std::string_view source);
+
+    size_t size() const { return _first + _tags.size(); }
+    bool empty() const { return size() == 0; }
+    size_t first() const { return _first; }
+    std::string_view source() const { return _source; }
+
+    Tag tag(size_t index) const { return _tags[index - _first]; }
+    uint32_t offset(size_t index) const { return _offsets[index - _first]; }
+    uint32_t length(size_t index) const { return _lengths[index - _first]; }
+    std::string_view content(size_t index) const {
+        return _source.substr(offset(index), length(index));
+    }
+    LexemView operator [] (size_t index) const {
+        return LexemView{content(index), offset(index), tag(index)};
+    }
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    void rebase();
+};
+
+
+class TokenStream::const_iterator {
+    const TokenStream* _stream = nullptr;
+    uint32_t _index = 0;
+
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = LexemView;
+    using difference_type = std::ptrdiff_t;
+    using reference = LexemView;
+
+    struct pointer {
+        LexemView view;
+        const LexemView* operator -> () const { return &view; }
+    };
+
+    const_iterator() = default;
+    const_iterator(const TokenStream* stream, uint32_t index)
+        : _stream(stream), _index(index) {}
+
+    LexemView operator * () const { return (*_stream)[_index]; }
+    pointer operator -> () const { return pointer{**this}; }
+    LexemView operator [] (difference_type n) const { return *(*this + n); }
+
+    Tag tag() const { return _stream->tag(_index); }
+    uint32_t index() const { return _index; }
+
+    const_iterator& operator ++ () { ++_index; return *this; }
+    const_iterator& operator -- () { --_index; return *this; }
+    const_iterator operator ++ (int) { auto old = *this; ++_index; return old; }
+    const_iterator operator -- (int) { auto old = *this; --_index; return old; }
+    const_iterator& operator += (difference_type n) {
+        _index += n;
+        return *this;
+    }
+    const_iterator& operator -= (difference_type n) {
+        _index -= n;
+        return *this;
+    }
+
+    friend const_iterator operator + (const_iterator it, difference_type n) {
+        return it += n;
+    }
+    friend const_iterator operator - (const_iterator it, difference_type n) {
+        return it -= n;
+    }
+    friend difference_type operator - (const const_iterator& lhs,
+                                       const const_iterator& rhs) {
+        return difference_type(lhs._index) - difference_type(rhs._index);
+    }
+    friend bool operator == (const const_iterator& lhs,
+                             const const_iterator& rhs) {
+        return lhs._index == rhs._index && lhs._stream == rhs._stream;
+    }
+    friend auto operator <=> (const const_iterator& lhs,
+                              const const_iterator& rhs) {
+        return lhs._index <=> rhs._index;
+    }
+};
+
+
+inline TokenStream::const_iterator TokenStream::begin() const {
+    return const_iterator(this, _first);
+}
+
+
+inline TokenStream::const_iterator TokenStream::end() const {
+    return const_iterator(this, static_cast<uint32_t>(size()));
+}
+
+std::ostream& operator << (std::ostream& os, const TokenStream& tokens);
+
+
+
+/*
+ * Why an input was rejected, for the overloads that report instead of
+ * throwing. From the lexer it is the first byte no rule matches and the
+ * number of tokens lexed before it. From a parse it is the farthest token
+ * a match failed at, or the one left over after the grammar was done,
+ * with the tags that were tried there.
+ */
+struct Failure {
+    uint64_t offset = 0;        // in the source, its length past the last token
+    uint32_t token = 0;
+    std::vector<Tag> expected;  // sorted, empty when only the end would do
+};
+
+
+
+/*
+ * Rules are compiled into one Scanner at construction, so a token costs a
+ * single pass over its bytes. Rules the Scanner can't express keep matching
+ * through std::regex, interleaved by rule priority. When the rules make an
+ * automaton too large, the literal ones, keywords and operators, are left
+ * to a trie that is walked once per token next to it.
+ *
+ * A Lexer is immutable once built: every tokenize keeps its position on the
+ * stack, so threads can share one instance.
+ */
+class LexemStream;
+// Appends the next chunk of input to the buffer, false once input is over.
+using ChunkSource = std::function<bool(std::string&)>;
+
+// Tokens [begin, end) of a stream that were replaced by `count` new ones.
+struct Damage {
+    uint32_t begin = 0;
+    uint32_t end = 0;
+    uint32_t count = 0;
+};
+
+
 class Lexer {
+    friend class LexemStream;
+    friend class TokenSource;
+
     const Rules _rules;
-    uint64_t _position;
+    const Priority _priority;
+    const Scanner _scanner;
+    // literal rules that aren't in the scanner
+    const Literals _literals;
+    // rules neither can express, in priority order
+    const std::vector<uint32_t> _fallback;
+
+public:
+    Lexer(Rules, Priority=Priority::First);
+    // A lexer emitted by parselib_lexgen with `scanner` compiled from
+    // `rules` at build time, so building it compiles nothing
+    Lexer(Rules, Scanner scanner, Priority=Priority::First);
+
+    Lexems tokenize(const std::string& input) const noexcept(false);
+    // fills `out` with views into `input`, reusing its storage
+    void tokenize(std::string_view input, TokenStream& out) const
+        noexcept(false);
+    // Same without throwing: false at the first byte no rule matches, with
+    // the tokens before it left in `out`
+    bool tokenize(std::string_view input, TokenStream& out,
+                  Failure& failure) const;
+
+    // Lexes chunks on `threads` threads (0 - one per core), each starting
+    // from a guessed boundary, and stitches them where neighbours agree.
+    // The result is identical to the sequential overloads.
+    void tokenize(std::string_view input, TokenStream& out,
+                  unsigned threads) const noexcept(false);
+    Lexems tokenize(const std::string& input, unsigned threads) const
+        noexcept(false);
+
+    // Brings `tokens` lexed from an older text up to date with `input`, in
+    // which `removed` bytes at `offset` were replaced by `inserted` ones.
+    // Lexing restarts a token before the edit, assuming no match looks
+    // further ahead than its next token, and stops as soon as a token past
+    // the edit starts where an old one did. Leaves `tokens` as they were
+    // when the input doesn't lex.
+    Damage relex(std::string_view input, TokenStream& tokens,
+                 uint64_t offset, uint64_t removed, uint64_t inserted) const
+        noexcept(false);
+
+    // Pulls input lazily; the lexer must outlive the returned stream.
+    LexemStream stream(std::istream&) const;
+    LexemStream stream(ChunkSource) const;
+    template <typename Iterator>
+    LexemStream stream(Iterator first, Iterator last) const;
+
+    Priority priority() const { return _priority; }
+    const Scanner& scanner() const { return _scanner; }
+    const Literals& literals() const { return _literals; }
+
+private:
+    // lexes the token at `position` and moves past it
+    Lexem findLexem(const std::string&, uint64_t& position) const
+        noexcept(false);
+    // With `more` set the input may continue past `end` and the match is
+    // marked truncated when extra bytes could change it; std::regex rules
+    // are trusted once `window` bytes are available.
+    Scanner::Match match(const char*, const char*, bool more=false,
+                         uint64_t window=0) const;
+};
+
+
+
+/*
+ * Tokens of an input that arrives in chunks. Only the unconsumed tail of
+ * the input is buffered, so memory is bounded by the longest token (or the
+ * std::regex window) plus one chunk, whatever the input size.
+ */
+class LexemStream {
+    const Lexer& _lexer;
+    ChunkSource _source;
+    std::string _buffer;
+    uint64_t _offset = 0;
+    size_t _cursor = 0;
+    uint64_t _window;
+    bool _finished = false;
 
 public:
-    Lexer(const Rules&);
+    class iterator;
+
+    static constexpr size_t chunk = 1 << 16;
+
+    LexemStream(const Lexer&, ChunkSource, uint64_t window=chunk);
 
-    Lexems tokenize(const std::string& input) noexcept(false);
+    // false once the input is exhausted
+    bool next(Lexem&) noexcept(false);
+    uint64_t position() const { return _offset + _cursor; }
+    size_t buffered() const { return _buffer.size(); }
+
+    iterator begin();
+    iterator end();
 
 private:
-    Lexem findLexem(const std::string&) noexcept(false);
+    void fill();
+};
+
+
+class LexemStream::iterator {
+    LexemStream* _stream = nullptr;
+    Lexem _current;
+
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Lexem;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Lexem*;
+    using reference = const Lexem&;
+
+    iterator() = default;
+    explicit iterator(LexemStream* stream) : _stream(stream) { ++*this; }
+
+    reference operator * () const { return _current; }
+    pointer operator -> () const { return &_current; }
+
+    iterator& operator ++ () {
+        if (!_stream->next(_current)) { _stream = nullptr; }
+        return *this;
+    }
+
+    friend bool operator == (const iterator& lhs, const iterator& rhs) {
+        return lhs._stream == rhs._stream;
+    }
+};
+
+
+inline LexemStream::iterator LexemStream::begin() { return iterator(this); }
+inline LexemStream::iterator LexemStream::end() { return iterator(); }
+
+
+
+/*
+ * Tokens of an input lexed as a parse asks for them, a batch at a time
+ * whenever it reaches the last one lexed. A rejected input is lexed only
+ * a little past where the parse gave up, and a byte no rule matches ends
+ * the tokens there, which fails the parse without a throw. Tokens before
+ * the floor passed to pull are forgotten once they outnumber the rest, so
+ * memory holds the tokens the parse may still read, not the whole input.
+ */
+class TokenSource {
+    const Lexer& _lexer;
+    std::string_view _input;
+    TokenStream _tokens;
+    uint64_t _offset = 0;
+    bool _failed = false;
+
+public:
+    static constexpr size_t batch = 256;
+
+    // the lexer and the input must outlive the source
+    TokenSource(const Lexer&, std::string_view input);
+
+    // Lexes up to a batch of tokens, false if there were none left; those
+    // before `floor` may be forgotten
+    bool pull(size_t floor=0);
+
+    const TokenStream& tokens() const { return _tokens; }
+    // lexing stopped at a byte no rule matches
+    bool failed() const { return _failed; }
+    // where lexing goes on, the offending byte once it failed
+    uint64_t offset() const { return _offset; }
 };
 
+
+template <typename Iterator>
+LexemStream Lexer::stream(Iterator first, Iterator last) const {
+    return stream(ChunkSource([first, last](std::string& buffer) mutable {
+        if (first == last) return false;
+        buffer.append(std::string_view(*first));
+        ++first;
+        return true;
+    }));
+}
+
 }
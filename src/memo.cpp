@@ -0,0 +1,64 @@
+#include <bit>
+#include <algorithm>
+
+#include "memo.hpp"
+
+using namespace parselib;
+
+
+
+Memo::Memo(size_t bytes) {
+    const size_t count = std::max<size_t>(bytes / sizeof(Entry), 2);
+    _slots.resize(std::bit_floor(count));
+}
+
+
+size_t Memo::slot(uint32_t parser, uint32_t position) const {
+    const uint64_t key = uint64_t(parser) << 32 | position;
+    const uint64_t hash = key * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(hash >> 32) & (_slots.size() - 2);
+}
+
+
+const Memo::Entry* Memo::find(uint32_t parser, uint32_t position) const {
+    if (!enabled()) return nullptr;
+
+    const size_t index = slot(parser, position);
+    for (size_t way = index; way < index + 2; ++way) {
+        const Entry& entry = _slots[way];
+        if (live(entry) && entry.parser == parser &&
+            entry.position == position) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+
+void Memo::store(uint32_t parser, uint32_t position, uint32_t end,
+                 bool accept, uint32_t reach) {
+    if (!enabled()) return;
+
+    const size_t index = slot(parser, position);
+    Entry* victim = &_slots[index];
+    for (size_t way = index; way < index + 2; ++way) {
+        Entry& entry = _slots[way];
+        const bool same = entry.parser == parser && entry.position == position;
+        if (!live(entry) || same) {
+            victim = &entry;
+            break;
+        }
+        if (entry.position < victim->position) { victim = &entry; }
+    }
+    *victim = Entry{parser, position, end, reach,
+                    _generation << 1 | uint32_t(accept)};
+}
+
+
+void Memo::clear() {
+    if (++_generation == (1u << 31)) {
+        // generations wrapped, forget everything for real
+        _generation = 1;
+        std::fill(_slots.begin(), _slots.end(), Entry{});
+    }
+}
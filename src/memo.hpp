@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace parselib {
+
+/*
+ * Packrat table: the outcome of a parser at a token position and how far
+ * its parse read, for the subtrees a later parse may reuse. The table has
+ * a fixed number of two-way slots, so memory stays bounded; on a collision
+ * the entry further behind the parse front is evicted. clear() is O(1).
+ */
+class Memo {
+public:
+    struct Entry {
+        uint32_t parser = 0;
+        uint32_t position = 0;
+        uint32_t end = 0;
+        uint32_t reach = 0;    // Context::reach of the parse itself
+        uint32_t stamp = 0;    // generation << 1 | accept
+
+        bool accept() const { return stamp & 1; }
+    };
+
+    static constexpr size_t default_size = size_t(64) << 20;
+
+private:
+    std::vector<Entry> _slots;
+    uint32_t _generation = 1;
+
+public:
+    Memo() = default;
+    explicit Memo(size_t bytes);
+
+    const Entry* find(uint32_t parser, uint32_t position) const;
+    void store(uint32_t parser, uint32_t position, uint32_t end, bool accept,
+               uint32_t reach=0);
+    void clear();
+
+    bool enabled() const { return !_slots.empty(); }
+    size_t capacity() const { return _slots.size(); }
+
+private:
+    size_t slot(uint32_t parser, uint32_t position) const;
+    bool live(const Entry& entry) const {
+        return entry.stamp >> 1 == _generation;
+    }
+};
+
+}
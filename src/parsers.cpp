@@ -1,77 +1,97 @@
+#include <atomic>
 #include <iostream>
 #include <cassert>
 #include <iterator>
+#include <algorithm>
 
-#include "constants.hpp"
 #include "parsers.hpp"
 
 
 namespace parselib {
 
-State::State()
-    : begin(std::cbegin(constants::empty<Lexems>()))
-    , end(std::end(constants::empty<Lexems>()))
-    , current(std::end(constants::empty<Lexems>()))
-    , tree(constants::empty<SyntaxTree>())
-    , accept(constants::empty<bool>())
-{}
-
-
-State::State(CLIterator begin,
-             CLIterator end,
-             CLIterator current,
-             SyntaxTree tree,
-             bool accept)
-    : begin(begin)
-    , end(end)
-    , current(current)
-    , tree(tree)
-    , accept(accept)
-{}
-
-
-std::ostream& parselib::operator << (std::ostream& os, const State& state) {
+std::ostream& operator << (std::ostream& os, const State& state) {
     os << "Accept - " << std::boolalpha
        << state.accept << " [Accepted substring: ";
-    for (auto current = state.begin; current < state.current; ++current) {
-        os << current->content << ";";
+    if (!state.context) return os << "]";
+
+    const TokenStream& tokens = state.tokens();
+    for (size_t index = 0; index < state.position; ++index) {
+        os << tokens.content(index) << ";";
     }
     os << "], [Raw substring: ";
-    for (auto current = state.current; current < state.end; ++current) {
-        os << current->content << ";";
+    for (size_t index = state.position; index < tokens.size(); ++index) {
+        os << tokens.content(index) << ";";
     }
     return os << "]";
 }
 
 
-bool parselib::terminate(const State& state) {
-    /* exit when execution reaches the end */
-    return state.current == state.end;
-}
+Atom::Atom(Tag tag) : IParser(), _tag(tag) {}
 
 
-Atom::Atom(Tag tag) : IParser(), _tag(tag) {}
+IParser* Atom::clone() const { return new Atom(_tag); }
+bool Atom::is_valid() const { return bool(_tag); }
 
 
-State Atom::operator () (State state) const {
-    state.accept = state.current->tag == _tag;
-    state.current += state.accept;
-    return state;
+IParser* Any::clone() const { return new Any; }
+bool Any::is_valid() const { return true; }
+
+
+
+uint32_t unique_id() {
+    static std::atomic<uint32_t> last{0};
+    return ++last;
 }
 
 
-IParser* Atom::clone() const { return new Atom(_tag); }
-bool Atom::is_valid() const { return bool(_tag); }
+bool graft(uint32_t id, State& state) {
+    FlatTree* flat = state.tree().flat();
+    if (!flat) return false;
 
+    const Reuse& reuse = *state.context->reuse;
+    const uint32_t node = reuse.graft(id, state.position, *flat);
+    if (node == FlatTree::none) return false;
 
-State Any::operator () (State state) const {
+    const FlatTree::Node& old = reuse.tree()[node];
+    const int64_t shift = reuse.shift(old);
+    state.position = old.end + shift;
     state.accept = true;
-    state.current += 1;
-    return state;
+    state.context->reach = std::max<uint32_t>(state.context->reach,
+                                              old.reach + shift);
+    return true;
+}
+
+
+
+bool First::contains(Tag tag) const {
+    return any || empty || std::binary_search(tags.begin(), tags.end(), tag);
+}
+
+
+First& First::merge(const First& other) {
+    std::vector<Tag> merged;
+    std::set_union(tags.begin(), tags.end(), other.tags.begin(),
+                   other.tags.end(), std::back_inserter(merged));
+    tags = std::move(merged);
+    any = any || other.any;
+    empty = empty || other.empty;
+    return *this;
+}
+
+
+First first_of(const IParser& parser) {
+    thread_local std::vector<const IParser*> visiting;
+    if (std::find(visiting.begin(), visiting.end(), &parser) !=
+        visiting.end()) {
+        return First::unknown();
+    }
+
+    visiting.push_back(&parser);
+    const First first = parser.first();
+    visiting.pop_back();
+    return first;
 }
 
-IParser* Any::clone() const { return new Any; }
-bool Any::is_valid() const { return true; }
 
 
 
@@ -83,9 +103,9 @@ Parser::~Parser() {
 Parser::Parser(const Parser& old) {
     if (this != &old) {
         _parser = old._parser != nullptr ? old._parser->clone() : nullptr;
-        _before = old._before;
-        _on_accept = old._on_accept;
-        _on_fail = old._on_fail;
+        _id = old._id;
+        _kind = old._kind;
+        _hooks = old._hooks;
     }
 }
 
@@ -95,9 +115,9 @@ const Parser& Parser::operator = (const Parser& old) {
 
     delete _parser;
     _parser = old._parser == nullptr ? nullptr : old._parser->clone();
-    _before = old._before;
-    _on_accept = old._on_accept;
-    _on_fail = old._on_fail;
+    _id = old._id;
+    _kind = old._kind;
+    _hooks = old._hooks;
     return *this;
 }
 
@@ -106,9 +126,9 @@ Parser::Parser(Parser&& old) noexcept {
     if (this != &old) {
         _parser = old._parser;
         old._parser = nullptr;
-        _before = std::move(old._before);
-        _on_accept = std::move(old._on_accept);
-        _on_fail = std::move(old._on_fail);
+        _id = old._id;
+        _kind = old._kind;
+        _hooks = std::move(old._hooks);
     }
 }
 
@@ -119,34 +139,105 @@ const Parser& Parser::operator = (Parser&& old) noexcept {
     delete _parser;
     _parser = old._parser;
     old._parser = nullptr;
-    _before = std::move(old._before);
-    _on_accept = std::move(old._on_accept);
-    _on_fail = std::move(old._on_fail);
+    _id = old._id;
+    _kind = old._kind;
+    _hooks = std::move(old._hooks);
     return *this;
 }
 
 
 State Parser::operator()(State state) const {
     assert(is_valid() && "using of unassigned parser");
-
-    if (_before) { _before(state); }
+    uint32_t memoized = 0;
+    if (recall(_id, state, memoized)) return state;
+
+    probe::enter(_id);
+    const State from = state;
+    const TreeBuilder::Mark mark = state.tree().mark();
+    FlatTree* flat = _kind == FlatTree::none ? nullptr : state.tree().flat();
+    const uint32_t node = flat ? flat->open(_kind, state.position, _id) : 0;
+    // a node records how far its own parse read
+    uint32_t& reach = state.context->reach;
+    const uint32_t outer = flat ? std::exchange(reach, state.position) : 0;
+    const Hooks* hooks = _hooks.get();
+    if (hooks && hooks->before) { hooks->before(state); }
     State result = _parser->operator()(state);
     if (result.accept) {
-        if (_on_accept) { _on_accept(result); }
+        if (hooks && hooks->on_accept) { hooks->on_accept(result); }
+        if (flat) { flat->close(node, result.position, reach); }
     } else {
-        if (_on_fail) { _on_fail(result); }
+        if (hooks && hooks->on_fail) { hooks->on_fail(result); }
+        if (flat) { flat->discard(node); }
+        result.tree().rollback(mark);
     }
+    if (flat) { reach = std::max(reach, outer); }
+    remember(_id, from, result, memoized);
+    probe::exit(result.accept);
     return result;
 }
 
 
-IParser* Parser::clone() const {
-    Parser* temp = nullptr;
-    if (is_valid()) {
-        temp = new Parser;
-        temp->_parser = _parser->clone();
+void Parser::compile(Compiler& compiler) const {
+    assert(is_valid() && "using of unassigned parser");
+    const Hooks* hooks = _hooks.get();
+    const auto hook = [&compiler](const Action& action) {
+        return action ? compiler.action(action) : Program::none;
+    };
+
+    const size_t recalled = compiler.emit(Op::RECALL, _id);
+    compiler.emit(Op::ENTER, _kind, _id);
+    if (hooks && hooks->before) {
+        compiler.emit(Op::ACTION, hook(hooks->before));
+    }
+    _parser->compile(compiler);
+    if (hooks && (hooks->on_accept || hooks->on_fail)) {
+        compiler.emit(Op::HOOK, hook(hooks->on_accept),
+                      hook(hooks->on_fail));
     }
-    return temp;
+    compiler.emit(Op::EXIT);
+    compiler.emit(Op::REMEMBER, _id);
+    compiler.patch(recalled);
+}
+
+
+First Parser::first() const {
+    return _parser ? _parser->first() : First::unknown();
+}
+
+
+Parser& Parser::name(std::string name) {
+    Profile::label(_id, std::move(name));
+    return *this;
+}
+
+
+// Hooks are copied on write, copies of a parser keep the old ones.
+Parser& Parser::on_before(Action before) {
+    Hooks hooks = _hooks ? *_hooks : Hooks{};
+    hooks.before = std::move(before);
+    _hooks = std::make_shared<const Hooks>(std::move(hooks));
+    return *this;
+}
+
+
+Parser& Parser::on_accept(Action onAccept) {
+    Hooks hooks = _hooks ? *_hooks : Hooks{};
+    hooks.on_accept = std::move(onAccept);
+    _hooks = std::make_shared<const Hooks>(std::move(hooks));
+    return *this;
+}
+
+
+Parser& Parser::on_disaccept(Action onFail) {
+    Hooks hooks = _hooks ? *_hooks : Hooks{};
+    hooks.on_fail = std::move(onFail);
+    _hooks = std::make_shared<const Hooks>(std::move(hooks));
+    return *this;
+}
+
+
+IParser* Parser::clone() const {
+    return is_valid() ? new Parser(*this) : nullptr;
 }
 
 
@@ -161,7 +252,11 @@ Forward Forward::Decl(Impl&& impl) {
 }
 
 
-Forward::Forward(Impl&& parser) : IParser(), _parser(move(parser)) {}
+Forward::Forward(Impl&& parser)
+    : IParser()
+    , _parser(move(parser))
+    , _id(unique_id())
+{}
 
 
 Forward::~Forward() {}
@@ -169,7 +264,13 @@ Forward::~Forward() {}
 
 State Forward::operator ()(State state) const {
     assert(is_valid() && "using of invalid parser");
+    uint32_t outer = 0;
+    if (recall(_id, state, outer)) return state;
+
+    probe::enter(_id);
     State result = _parser(*this, state);
+    remember(_id, state, result, outer);
+    probe::exit(result.accept);
     return result;
 }
 
@@ -177,6 +278,7 @@ State Forward::operator ()(State state) const {
 IParser* Forward::clone() const {
     Forward* newFwd = new Forward;
     newFwd->_parser = _parser;
+    newFwd->_id = _id;
     return newFwd;
 }
 
@@ -187,26 +289,420 @@ bool Forward::is_valid() const {
 
 
 
-bool Driver::accept(const Lexems& input, AST* tree) {
-    if (distance(cbegin(input), cend(input)) == 0) return false;
+namespace {
+
+template <typename Table> auto find(const Table& table, Tag tag) {
+    return tag < table.size() && table[tag].precedence ? &table[tag]
+                                                       : nullptr;
+}
+
+
+template <typename Table, typename Operator>
+void declare(Table& table, Tag tag, Operator&& op) {
+    assert(op.precedence > 0 && "operator precedence starts at one");
+    if (table.size() <= tag) { table.resize(tag + 1); }
+    table[tag] = std::forward<Operator>(op);
+}
+
+}
+
 
-    State start {cbegin(input), cend(input), cbegin(input), SyntaxTree{tree}};
-    _finish = _parser(start);
-    return is_accept(start);
+Operators& Operators::prefix(Tag tag, unsigned precedence, Action before,
+                             Action on_accept) {
+    declare(_prefix, tag, Operator{precedence, Assoc::Right,
+                                   std::move(before), std::move(on_accept)});
+    return *this;
+}
+
+
+Operators& Operators::infix(Tag tag, unsigned precedence, Assoc assoc,
+                            Action before, Action on_accept) {
+    declare(_infix, tag, Operator{precedence, assoc,
+                                  std::move(before), std::move(on_accept)});
+    return *this;
 }
 
 
-SyntaxTree Driver::parse(const Lexems& input, AST* tree) {
-    if (input.size() == 0) return SyntaxTree(nullptr);
+Operators& Operators::postfix(Tag tag, unsigned precedence, Action before,
+                              Action on_accept) {
+    declare(_postfix, tag, Operator{precedence, Assoc::Left,
+                                    std::move(before), std::move(on_accept)});
+    return *this;
+}
+
 
-    State start{cbegin(input), cend(input), cbegin(input), SyntaxTree(tree)};
-    _finish = _parser(start);
-    return is_accept(start) ? _finish.tree : SyntaxTree(nullptr);
+// Matches the operator token and runs its before hook. A node the hook
+// opens takes the nodes built since `operand`.
+State Operators::open(const Operator& op, State state,
+                      TreeBuilder::Mark operand) const {
+    state.position += 1;
+    state.accept = true;
+    if (op.before) {
+        AST* cursor = state.tree().cursor();
+        op.before(state);
+        if (state.tree().cursor() != cursor) {
+            state.tree().adopt(operand);
+        }
+    }
+    return state;
 }
 
 
-bool Driver::is_accept(const State& start) const {
-    return _finish.accept && _finish.current == start.end;
+State Operators::climb(State state, unsigned min) const {
+    // every operand takes at least one token
+    const TreeBuilder::Mark mark = state.tree().mark();
+    if (terminate(state)) return backtrack(state, mark);
+    const auto tag = [](const State& state) {
+        return state.peek();
+    };
+
+    State left;
+    const Operator* op = find(_prefix, tag(state));
+    if (op) {
+        left = climb(open(*op, state, mark), op->precedence);
+        if (!left.accept) return backtrack(state, mark);
+        if (op->on_accept) { op->on_accept(left); }
+    } else {
+        left = _primary(state);
+        if (!left.accept) return backtrack(state, mark);
+    }
+
+    while (!terminate(left)) {
+        if ((op = find(_postfix, tag(left))) && op->precedence >= min) {
+            left = open(*op, left, mark);
+            if (op->on_accept) { op->on_accept(left); }
+            continue;
+        }
+
+        op = find(_infix, tag(left));
+        if (!op || op->precedence < min) break;
+
+        const TreeBuilder::Mark before = left.tree().mark();
+        const unsigned next = op->precedence + (op->assoc == Assoc::Left);
+        State right = climb(open(*op, left, mark), next);
+        if (!right.accept) {
+            left.tree().rollback(before);
+            break;
+        }
+        if (op->on_accept) { op->on_accept(right); }
+        left = right;
+    }
+    return left;
+}
+
+
+
+First Operators::first() const {
+    First first = _primary.first();
+    for (Tag tag = 0; tag < _prefix.size(); ++tag) {
+        if (_prefix[tag].precedence) { first.merge(First{{tag}}); }
+    }
+    return first;
+}
+
+
+
+Choice::Choice(const std::vector<Parser>& alternatives) : IParser() {
+    for (const Parser& alternative : alternatives) {
+        _alternatives.push_back(std::make_shared<const Parser>(alternative));
+    }
+}
+
+
+State Choice::operator () (State state) const {
+    if (terminate(state)) return state;
+
+    const TreeBuilder::Mark mark = state.tree().mark();
+    const uint64_t start = probe::start();
+    const auto [begin, end] = candidates(state.peek());
+    for (const uint32_t* candidate = begin; candidate != end; ++candidate) {
+        State result = (*_alternatives[*candidate])(state);
+        if (result.accept) {
+            probe::choice(true);
+            return result;
+        }
+        probe::retry(start);
+        state.tree().rollback(mark);
+    }
+    probe::choice(false);
+    for (const Tag tag : table().tags) { state.expect(tag); }
+    return backtrack(state, mark);
+}
+
+
+bool Choice::is_valid() const {
+    return std::any_of(_alternatives.begin(), _alternatives.end(),
+                       [](const auto& parser) { return parser->is_valid(); });
+}
+
+
+First Choice::first() const {
+    First first;
+    for (const auto& alternative : _alternatives) {
+        first.merge(alternative->first());
+    }
+    return first;
+}
+
+
+void Choice::compile(Compiler& compiler) const {
+    const size_t end = compiler.emit(Op::JEND);
+    compiler.emit(Op::CHOICE);
+    const uint32_t jumps = compiler.jumps();
+    compiler.emit(Op::JTAB, jumps);
+
+    // one block per alternative, entered through the jump table and
+    // skipped by MISS when the next token is not in its FIRST set
+    std::vector<uint32_t> starts;
+    std::vector<size_t> accepted;
+    for (const auto& alternative : _alternatives) {
+        starts.push_back(compiler.here());
+        const First first = alternative->first();
+        const bool guarded = !first.any && !first.empty;
+        const size_t miss = guarded ? compiler.emit(
+            Op::MISS, compiler.set({first.tags.begin(), first.tags.end()}))
+            : 0;
+        compiler.emit(Op::RETRY);
+        alternative->compile(compiler);
+        accepted.push_back(compiler.emit(Op::JACC));
+        if (guarded) { compiler.patch(miss); }
+    }
+    const uint32_t failed = compiler.here();
+    const Table& table = this->table();
+    if (!table.tags.empty()) {
+        compiler.emit(Op::EXPECT, compiler.set(table.tags));
+    }
+    compiler.emit(Op::FAIL);
+    const size_t done = compiler.emit(Op::JUMP);
+    for (size_t jump : accepted) { compiler.patch(jump); }
+    compiler.emit(Op::COMMIT);
+    compiler.patch(done);
+    compiler.patch(end);
+
+    std::vector<uint32_t>& targets = compiler.jumps(jumps);
+    for (Tag tag = 0; tag + 1 < table.offsets.size(); ++tag) {
+        const auto [begin, last] = candidates(tag);
+        targets.push_back(begin == last ? failed : starts[*begin]);
+    }
+    targets.push_back(table.fallback.empty() ? failed
+                                             : starts[table.fallback[0]]);
+}
+
+
+const Choice::Table& Choice::table() const {
+    std::call_once(_table->built, [this] {
+        std::vector<First> firsts;
+        Tag top = 0;
+        for (const auto& alternative : _alternatives) {
+            firsts.push_back(alternative->first());
+            if (!firsts.back().tags.empty()) {
+                top = std::max(top, firsts.back().tags.back());
+            }
+        }
+
+        Table& table = *_table;
+        for (const First& first : firsts) {
+            table.tags.insert(table.tags.end(), first.tags.begin(),
+                              first.tags.end());
+        }
+        std::sort(table.tags.begin(), table.tags.end());
+        table.tags.erase(std::unique(table.tags.begin(), table.tags.end()),
+                         table.tags.end());
+        table.offsets.push_back(0);
+        for (Tag tag = 0; tag <= top; ++tag) {
+            for (uint32_t index = 0; index < firsts.size(); ++index) {
+                if (firsts[index].contains(tag)) {
+                    table.candidates.push_back(index);
+                }
+            }
+            table.offsets.push_back(table.candidates.size());
+        }
+        for (uint32_t index = 0; index < firsts.size(); ++index) {
+            if (firsts[index].any || firsts[index].empty) {
+                table.fallback.push_back(index);
+            }
+        }
+    });
+    return *_table;
+}
+
+
+std::pair<const uint32_t*, const uint32_t*> Choice::candidates(Tag tag) const {
+    const Table& table = this->table();
+    if (tag + 1 < table.offsets.size()) {
+        const uint32_t* data = table.candidates.data();
+        return {data + table.offsets[tag], data + table.offsets[tag + 1]};
+    }
+    const uint32_t* data = table.fallback.data();
+    return {data, data + table.fallback.size()};
+}
+
+
+
+Driver& Driver::packrat(size_t bytes) {
+    _packrat = bytes;
+    return *this;
+}
+
+
+Driver& Driver::compile() {
+    _program = Compiler::compile(_parser);
+    return *this;
+}
+
+
+bool Driver::accept(Session& session, const TokenStream& input,
+                    AST* tree) const {
+    if (empty(session, input)) return false;
+    return run(session, input, tree);
+}
+
+
+SyntaxTree Driver::parse(Session& session, const TokenStream& input,
+                         AST* tree) const {
+    if (empty(session, input)) return SyntaxTree(nullptr);
+    return run(session, input, tree) ? session._context.tree.tree()
+                                     : SyntaxTree(nullptr);
+}
+
+
+SyntaxTree Driver::parse(Session& session, const TokenStream& input,
+                         Arena& arena, AST* tree) const {
+    if (empty(session, input)) return SyntaxTree(nullptr);
+    return run(session, input, tree, &arena) ? session._context.tree.tree()
+                                             : SyntaxTree(nullptr);
+}
+
+
+bool Driver::parse(Session& session, const TokenStream& input,
+                   FlatTree& tree) const {
+    if (empty(session, input)) {
+        tree.clear();
+        return false;
+    }
+    if (!run(session, input, nullptr, nullptr, &tree)) return false;
+    tree.finalize();
+    return true;
+}
+
+
+bool Driver::parse(Session& session, const TokenStream& input,
+                   FlatTree& tree, const Reuse& reuse) const {
+    if (empty(session, input)) {
+        tree.clear();
+        return false;
+    }
+    if (!run(session, input, nullptr, nullptr, &tree, &reuse)) return false;
+    tree.finalize();
+    return true;
+}
+
+
+bool Driver::accept(Session& session, TokenSource& source) const {
+    if (empty(session, source)) return false;
+    return run(session, source.tokens(), nullptr, nullptr, nullptr, nullptr,
+               &source);
+}
+
+
+bool Driver::parse(Session& session, TokenSource& source,
+                   FlatTree& tree) const {
+    if (empty(session, source)) {
+        tree.clear();
+        return false;
+    }
+    if (!run(session, source.tokens(), nullptr, nullptr, &tree, nullptr,
+             &source)) {
+        return false;
+    }
+    tree.finalize();
+    return true;
+}
+
+
+bool Driver::accept(Session& session, const Lexems& input, AST* tree) const {
+    session._tokens = TokenStream(input);
+    return accept(session, session._tokens, tree);
+}
+
+
+SyntaxTree Driver::parse(Session& session, const Lexems& input,
+                         AST* tree) const {
+    session._tokens = TokenStream(input);
+    return parse(session, session._tokens, tree);
+}
+
+
+void Driver::fail(Session& session) {
+    const Context& context = session._context;
+    const TokenStream& tokens = *context.tokens;
+    const State& finish = session._finish;
+    Failure& failure = session._failure;
+    // an accepted prefix stops before a token nothing tried
+    failure.token = context.farthest;
+    failure.expected = context.expected;
+    if (finish.accept && finish.position > context.farthest) {
+        failure.token = finish.position;
+        failure.expected.clear();
+    }
+    std::sort(failure.expected.begin(), failure.expected.end());
+    // a source may have forgotten the token, or stopped at a byte no rule
+    // matches before the end of its input
+    failure.token = std::max<size_t>(failure.token, tokens.first());
+    failure.offset = failure.token < tokens.size()
+                   ? tokens.offset(failure.token)
+                   : context.source ? context.source->offset()
+                                    : tokens.source().size();
+}
+
+
+bool Driver::empty(Session& session, const TokenStream& input) {
+    if (!input.empty()) return false;
+    session._failure = Failure{};
+    return true;
+}
+
+
+bool Driver::empty(Session& session, TokenSource& source) {
+    if (!source.tokens().empty() || source.pull()) return false;
+    session._failure = Failure{};
+    session._failure.offset = source.offset();
+    return true;
+}
+
+
+bool Driver::run(Session& session, const TokenStream& input, AST* tree,
+                 Arena* arena, FlatTree* flat, const Reuse* reuse,
+                 TokenSource* source) const {
+    if (session._packrat != _packrat) {
+        session._memo = _packrat == 0 ? Memo() : Memo(_packrat);
+        session._packrat = _packrat;
+    }
+    Memo& memo = session._memo;
+    Context& context = session._context;
+    context.tokens = &input;
+    context.tree.reset(tree, arena, flat);
+    memo.clear();
+    context.memo = memo.enabled() ? &memo : nullptr;
+    context.reuse = reuse;
+    context.reach = 0;
+    context.farthest = 0;
+    context.expected.clear();
+    context.source = source;
+    context.floor = 0;
+    // trees keep positions into the tokens, so only accept slides them
+    context.window = source && !tree && !arena && !flat;
+
+    const State start(&context, 0);
+    State& finish = session._finish;
+    finish = _program.empty() ? _parser(start) : _program.run(start);
+    const bool accept = finish.accept && terminate(finish) &&
+                        !(source && source->failed());
+    if (!accept) {
+        context.tree.rollback({});
+        fail(session);
+    }
+    return accept;
 }
 
 }
@@ -1,32 +1,118 @@
 #pragma once
 
+#include <mutex>
+#include <tuple>
+#include <algorithm>
+#include <memory>
 #include <ostream>
 #include <type_traits>
 #include <functional>
 
+#include "vm.hpp"
+#include "memo.hpp"
 #include "lexer.hpp"
+#include "profile.hpp"
 #include "language.hpp"
 
 
 namespace parselib {
 
-using CLIterator = std::vector<parselib::Lexem>::const_iterator;
+using CLIterator = TokenStream::const_iterator;
+
+// Everything a parse shares: the input, the tree under construction, the
+// packrat table and the subtrees reusable from a parse before an edit.
+struct Context {
+    const TokenStream* tokens = nullptr;
+    TreeBuilder tree;
+    Memo* memo = nullptr;
+    const Reuse* reuse = nullptr;
+    // One past the furthest token a failed match read. A parse depended on
+    // the tokens before this or before its own end, whichever is further;
+    // matched tokens are covered by the position they move to.
+    uint32_t reach = 0;
+    // The furthest token a match failed at and the tags tried there, kept
+    // for Session::failure at the cost of a compare per failed match.
+    uint32_t farthest = 0;
+    std::vector<Tag> expected;
+    // Lexes more tokens when a parse reaches the last one. With `window`
+    // set the VM keeps `floor` at the oldest token it may read again, and
+    // the source forgets those before it.
+    TokenSource* source = nullptr;
+    uint32_t floor = 0;
+    bool window = false;
+
+    void expect(uint32_t position, Tag tag) {
+        if (position < farthest) return;
+        if (position > farthest) {
+            farthest = position;
+            expected.clear();
+        }
+        if (std::find(expected.begin(), expected.end(), tag) ==
+            expected.end()) {
+            expected.push_back(tag);
+        }
+    }
+};
+
+
+// Passed by value through every parser call, so it stays a few words wide.
 struct State {
-    CLIterator begin;
-    CLIterator end;
-    CLIterator current;
-    parselib::SyntaxTree tree;
-    bool accept;
-
-    State();
-    State(CLIterator, CLIterator, CLIterator, SyntaxTree, bool=false);
+    Context* context = nullptr;
+    uint32_t position = 0;
+    bool accept = false;
+
+    State() = default;
+    State(Context* context, uint32_t position, bool accept=false)
+        : context(context), position(position), accept(accept)
+    {}
+
+    const TokenStream& tokens() const { return *context->tokens; }
+    TreeBuilder& tree() const { return context->tree; }
+    CLIterator current() const { return tokens().begin() + position; }
+    // the parse depends on the next token though it doesn't take it
+    void read() const {
+        context->reach = std::max(context->reach, position + 1);
+    }
+    Tag peek() const {
+        read();
+        return tokens().tag(position);
+    }
+    // a token tagged `tag` would have matched here
+    void expect(Tag tag) const { context->expect(position, tag); }
+
+    bool operator == (const State&) const = default;
 };
 
-bool operator == (const State&, const State&);
-bool operator != (const State&, const State&);
 std::ostream& operator << (std::ostream& os, const State& state);
 
-bool terminate(const State&);
+inline bool terminate(const State& state) {
+    /* exit when execution reaches the end */
+    const Context* context = state.context;
+    return state.position == context->tokens->size() &&
+           !(context->source && context->source->pull(context->floor));
+}
+
+
+// Fails `state`, discarding the tree built since `mark`.
+inline State backtrack(State state, TreeBuilder::Mark mark) {
+    state.tree().rollback(mark);
+    state.accept = false;
+    return state;
+}
+
+
+// The tokens a parser can start with.
+struct First {
+    std::vector<Tag> tags;      // sorted
+    bool any = false;           // may start with any token
+    bool empty = false;         // may accept without taking a token
+
+    // what is assumed of parsers that can't tell
+    static First unknown() { return First{{}, true, true}; }
+
+    bool contains(Tag) const;
+    First& merge(const First&);
+};
 
 
 class IParser {
@@ -41,6 +127,10 @@ public:
     virtual State operator () (State) const = 0;
     virtual IParser* clone() const = 0;
     virtual bool is_valid() const = 0;
+
+    // emits bytecode for this parser, by default a call to it
+    virtual void compile(Compiler& compiler) const { compiler.native(*this); }
+    virtual First first() const { return First::unknown(); }
 };
 template <typename T> concept parser_c = std::is_base_of<IParser, T>::value;
 
@@ -53,9 +143,24 @@ public:
     Atom(Tag tag);
     ~Atom() override = default;
 
-    State operator () (State) const override;
+    State operator () (State state) const override {
+        state.accept = !terminate(state) &&
+                       state.tokens().tag(state.position) == _tag;
+        if (!state.accept) {
+            state.read();
+            state.expect(_tag);
+        }
+        state.position += state.accept;
+        probe::consume(state.accept);
+        return state;
+    }
+
     IParser* clone() const override;
     bool is_valid() const override;
+    void compile(Compiler& compiler) const override {
+        compiler.emit(Op::MATCH, _tag);
+    }
+    First first() const override { return First{{_tag}}; }
 };
 
 
@@ -65,9 +170,20 @@ public:
     Any() = default;
     ~Any() override = default;
 
-    State operator() (State) const override;
+    State operator() (State state) const override {
+        state.accept = !terminate(state);
+        if (!state.accept) { state.read(); }
+        state.position += state.accept;
+        probe::consume(state.accept);
+        return state;
+    }
+
     IParser* clone() const override;
     bool is_valid() const override;
+    void compile(Compiler& compiler) const override {
+        compiler.emit(Op::ANY);
+    }
+    First first() const override { return First{{}, true}; }
 };
 
 
@@ -81,25 +197,28 @@ public:
 
     And(Left left, Right right)
         : IParser()
-        , _left(left)
-        , _right(right)
+        , _left(std::move(left))
+        , _right(std::move(right))
     {}
 
     State operator () (State state) const override {
         if (terminate(state)) return state;
 
+        const TreeBuilder::Mark mark = state.tree().mark();
+        const uint64_t start = probe::start();
         State l_result = _left(state);
         if (l_result.accept == false) {
-            state.accept = false;
-            return state;
+            probe::sequence(false, start);
+            return backtrack(state, mark);
         }
 
         State r_result = _right(l_result);
         if (r_result.accept == false) {
-            state.accept = false;
-            return state;
+            probe::sequence(false, start);
+            return backtrack(state, mark);
         }
 
+        probe::sequence(true, start);
         return r_result;
     }
 
@@ -108,7 +227,32 @@ public:
     }
 
     bool is_valid() const override {
-        return _left.isValid() && _right.isValid();
+        return _left.is_valid() && _right.is_valid();
+    }
+
+    void compile(Compiler& compiler) const override {
+        const size_t end = compiler.emit(Op::JEND);
+        compiler.emit(Op::CHOICE);
+        _left.compile(compiler);
+        const size_t left_failed = compiler.emit(Op::JNOT);
+        _right.compile(compiler);
+        const size_t right_failed = compiler.emit(Op::JNOT);
+        compiler.emit(Op::COMMIT);
+        const size_t done = compiler.emit(Op::JUMP);
+        compiler.patch(left_failed);
+        compiler.patch(right_failed);
+        compiler.emit(Op::FAIL);
+        compiler.patch(done);
+        compiler.patch(end);
+    }
+
+    First first() const override {
+        First first = _left.first();
+        if (first.empty) {
+            const First right = _right.first();
+            first.merge(right).empty = right.empty;
+        }
+        return first;
     }
 };
 
@@ -122,25 +266,30 @@ public:
 
     Or(Left left, Right right)
         : IParser()
-        , _left(left)
-        , _right(right)
+        , _left(std::move(left))
+        , _right(std::move(right))
     {}
 
     State operator () (State state) const override {
         if (terminate(state)) return state;
 
+        const TreeBuilder::Mark mark = state.tree().mark();
+        const uint64_t start = probe::start();
         State result = _left(state);
         if (result.accept == true) {
+            probe::choice(true);
             return result;
         }
 
+        probe::retry(start);
+        state.tree().rollback(mark);
         result = _right(state);
+        probe::choice(result.accept);
         if (result.accept == true) {
             return result;
         }
 
-        state.accept = false;
-        return state;
+        return backtrack(state, mark);
     }
 
     IParser* clone() const override {
@@ -148,20 +297,304 @@ public:
     }
 
     bool is_valid() const override {
-        return _left.isValid() || _right.isValid();
+        return _left.is_valid() || _right.is_valid();
+    }
+
+    void compile(Compiler& compiler) const override {
+        const size_t end = compiler.emit(Op::JEND);
+        compiler.emit(Op::CHOICE);
+        _left.compile(compiler);
+        const size_t left_accepted = compiler.emit(Op::JACC);
+        compiler.emit(Op::RETRY);
+        _right.compile(compiler);
+        const size_t right_accepted = compiler.emit(Op::JACC);
+        compiler.emit(Op::FAIL);
+        const size_t done = compiler.emit(Op::JUMP);
+        compiler.patch(left_accepted);
+        compiler.patch(right_accepted);
+        compiler.emit(Op::COMMIT);
+        compiler.patch(done);
+        compiler.patch(end);
+    }
+
+    First first() const override {
+        return _left.first().merge(_right.first());
+    }
+};
+
+
+/*
+ * Repetitions loop in place instead of recursing, so lists of any length
+ * take constant stack and the elements' actions append siblings under the
+ * same node. A repetition stops at the first element that fails or takes
+ * no tokens, and rolls that element back.
+ */
+template <parser_c P> class Many final : public IParser {
+    P _parser;
+
+public:
+    Many() = default;
+    Many(P parser) : IParser(), _parser(std::move(parser)) {}
+
+    // zero or more elements, always accepts
+    State operator () (State state) const override {
+        state = repeat(_parser, state);
+        state.accept = true;
+        return state;
+    }
+
+    IParser* clone() const override { return new Many(*this); }
+    bool is_valid() const override { return _parser.is_valid(); }
+
+    void compile(Compiler& compiler) const override {
+        loop(compiler, _parser);
+        compiler.emit(Op::ACCEPT, true);
+    }
+
+    First first() const override {
+        First first = _parser.first();
+        first.empty = true;
+        return first;
+    }
+
+    // Runs `parser` on `state` until it stops making progress
+    template <parser_c Element>
+    static State repeat(const Element& parser, State state) {
+        while (!terminate(state)) {
+            const TreeBuilder::Mark mark = state.tree().mark();
+            State next = parser(state);
+            if (!next.accept || next.position == state.position) {
+                state.tree().rollback(mark);
+                break;
+            }
+            state = next;
+        }
+        return state;
+    }
+
+    // The same loop in bytecode; `prefix` is emitted before every element
+    template <parser_c Element, typename Prefix=std::nullptr_t>
+    static void loop(Compiler& compiler, const Element& parser,
+                     const Prefix& prefix=nullptr) {
+        const uint32_t start = compiler.here();
+        const size_t end = compiler.emit(Op::JEND);
+        compiler.emit(Op::CHOICE);
+        std::vector<size_t> undo;
+        if constexpr (!std::is_same_v<Prefix, std::nullptr_t>) {
+            prefix.compile(compiler);
+            undo.push_back(compiler.emit(Op::JNOT));
+        }
+        parser.compile(compiler);
+        undo.push_back(compiler.emit(Op::JNOT));
+        undo.push_back(compiler.emit(Op::JSTAY));
+        compiler.emit(Op::COMMIT);
+        compiler.emit(Op::JUMP, start);
+        for (size_t jump : undo) { compiler.patch(jump); }
+        compiler.emit(Op::FAIL);
+        compiler.patch(end);
+    }
+};
+
+
+// One or more elements.
+template <parser_c P> class Some final : public IParser {
+    P _parser;
+
+public:
+    Some() = default;
+    Some(P parser) : IParser(), _parser(std::move(parser)) {}
+
+    State operator () (State state) const override {
+        if (terminate(state)) {
+            state.accept = false;
+            return state;
+        }
+
+        const TreeBuilder::Mark mark = state.tree().mark();
+        State first = _parser(state);
+        if (!first.accept || first.position == state.position) {
+            return backtrack(state, mark);
+        }
+        first = Many<P>::repeat(_parser, first);
+        first.accept = true;
+        return first;
+    }
+
+    IParser* clone() const override { return new Some(*this); }
+    bool is_valid() const override { return _parser.is_valid(); }
+
+    void compile(Compiler& compiler) const override {
+        const size_t end = compiler.emit(Op::JEND);
+        compiler.emit(Op::CHOICE);
+        _parser.compile(compiler);
+        const size_t failed = compiler.emit(Op::JNOT);
+        const size_t stayed = compiler.emit(Op::JSTAY);
+        compiler.emit(Op::COMMIT);
+        Many<P>::loop(compiler, _parser);
+        compiler.emit(Op::ACCEPT, true);
+        const size_t done = compiler.emit(Op::JUMP);
+        compiler.patch(failed);
+        compiler.patch(stayed);
+        compiler.emit(Op::FAIL);
+        const size_t rejected = compiler.emit(Op::JUMP);
+        compiler.patch(end);
+        compiler.emit(Op::ACCEPT, false);
+        compiler.patch(done);
+        compiler.patch(rejected);
+    }
+
+    First first() const override { return _parser.first(); }
+};
+
+
+// Zero or one element, always accepts.
+template <parser_c P> class Optional final : public IParser {
+    P _parser;
+
+public:
+    Optional() = default;
+    Optional(P parser) : IParser(), _parser(std::move(parser)) {}
+
+    State operator () (State state) const override {
+        const TreeBuilder::Mark mark = state.tree().mark();
+        State result = _parser(state);
+        if (result.accept) return result;
+
+        state.tree().rollback(mark);
+        state.accept = true;
+        return state;
+    }
+
+    IParser* clone() const override { return new Optional(*this); }
+    bool is_valid() const override { return _parser.is_valid(); }
+
+    void compile(Compiler& compiler) const override {
+        compiler.emit(Op::CHOICE);
+        _parser.compile(compiler);
+        const size_t accepted = compiler.emit(Op::JACC);
+        compiler.emit(Op::FAIL);
+        compiler.emit(Op::ACCEPT, true);
+        const size_t done = compiler.emit(Op::JUMP);
+        compiler.patch(accepted);
+        compiler.emit(Op::COMMIT);
+        compiler.patch(done);
+    }
+
+    First first() const override {
+        First first = _parser.first();
+        first.empty = true;
+        return first;
+    }
+};
+
+
+// One or more elements with separators between them; a trailing separator
+// is left unparsed.
+template <parser_c P, parser_c Sep> class SepBy final : public IParser {
+    P _parser;
+    Sep _separator;
+
+public:
+    SepBy() = default;
+    SepBy(P parser, Sep separator)
+        : IParser()
+        , _parser(std::move(parser))
+        , _separator(std::move(separator))
+    {}
+
+    State operator () (State state) const override {
+        const TreeBuilder::Mark mark = state.tree().mark();
+        State result = _parser(state);
+        if (!result.accept) return backtrack(state, mark);
+
+        result = Many<And<Sep, P>>::repeat(And<Sep, P>(_separator, _parser),
+                                           result);
+        result.accept = true;
+        return result;
+    }
+
+    IParser* clone() const override { return new SepBy(*this); }
+    bool is_valid() const override {
+        return _parser.is_valid() && _separator.is_valid();
     }
+
+    void compile(Compiler& compiler) const override {
+        compiler.emit(Op::CHOICE);
+        _parser.compile(compiler);
+        const size_t failed = compiler.emit(Op::JNOT);
+        compiler.emit(Op::COMMIT);
+        Many<P>::loop(compiler, _parser, _separator);
+        compiler.emit(Op::ACCEPT, true);
+        const size_t done = compiler.emit(Op::JUMP);
+        compiler.patch(failed);
+        compiler.emit(Op::FAIL);
+        compiler.patch(done);
+    }
+
+    First first() const override { return _parser.first(); }
 };
 
 
+
+// Identity shared by a parser and its copies, keys the packrat table.
+uint32_t unique_id();
+
+// FIRST of a parser that may be reached again while it is computed, as
+// recursive grammars are; a cycle yields First::unknown().
+First first_of(const IParser&);
+
+
+bool graft(uint32_t id, State& state);
+
+// Replays a cached outcome or a reused subtree into `state`, true on a hit.
+// A miss to be cached restarts Context::reach at the position, keeping the
+// reach so far in `outer`, so that remember() can store how far the parse
+// itself read and a hit can replay it.
+inline bool recall(uint32_t id, State& state, uint32_t& outer) {
+    if (state.context->reuse) [[unlikely]] {
+        if (!terminate(state) && graft(id, state)) return true;
+    }
+    Memo* memo = state.context->memo;
+    if (!memo || terminate(state)) return false;
+
+    uint32_t& reach = state.context->reach;
+    const Memo::Entry* entry = memo->find(id, state.position);
+    if (!entry) {
+        outer = std::exchange(reach, state.position);
+        return false;
+    }
+    state.position = entry->end;
+    state.accept = entry->accept();
+    reach = std::max(reach, entry->reach);
+    return true;
+}
+
+
+// At the end of input the result depends on the incoming accept flag,
+// so only positions before it are cached.
+inline void remember(uint32_t id, const State& from, const State& result,
+                     uint32_t outer) {
+    Memo* memo = from.context->memo;
+    if (!memo || terminate(from)) return;
+    uint32_t& reach = from.context->reach;
+    memo->store(id, from.position, result.position, result.accept, reach);
+    reach = std::max(reach, outer);
+}
+
+
 using Action = std::function<void(State&)>;
-static Action skip = [](State&){};
 class Parser : public IParser {
-    IParser* _parser;
+    struct Hooks {
+        Action before;
+        Action on_accept;
+        Action on_fail;
+    };
 
-    // do nothing by default;
-    Action _before = skip;
-    Action _on_accept = skip;
-    Action _on_fail = skip;
+    IParser* _parser;
+    uint32_t _id = 0;
+    uint32_t _kind = FlatTree::none;
+    // shared between copies, null while no action is set
+    std::shared_ptr<const Hooks> _hooks;
 
 public:
     Parser() : IParser(), _parser(nullptr) {}
@@ -171,19 +604,28 @@ public:
     const Parser& operator = (Parser&&) noexcept;
     ~Parser() override;
 
-    template <parser_c This> Parser(const This& parser) : IParser() {
-        This* temp = new This;
-        *temp = parser;
-        _parser = temp;
+    template <parser_c This> Parser(const This& parser)
+        : IParser()
+        , _id(unique_id())
+    {
+        _parser = new This(parser);
     }
 
     State operator () (State state) const override final;
     IParser* clone() const override final;
     bool is_valid() const override final;
-
-    Parser& on_before(Action before) { _before = before; return *this; }
-    Parser& on_accept(Action onAccept) { _on_accept = onAccept; return *this; }
-    Parser& on_disaccept(Action onFail) { _on_fail = onFail; return *this; }
+    void compile(Compiler&) const override final;
+    First first() const override final;
+
+    Parser& on_before(Action before);
+    Parser& on_accept(Action onAccept);
+    Parser& on_disaccept(Action onFail);
+    // Accepted matches become nodes of this kind in a FlatTree
+    Parser& kind(uint32_t kind) { _kind = kind; return *this; }
+    uint32_t kind() const { return _kind; }
+    // names the parser and its copies in profiles
+    Parser& name(std::string name);
+    uint32_t id() const { return _id; }
 };
 
 
@@ -192,6 +634,7 @@ class Forward : public IParser {
     using Impl = std::function<State(const Forward&, const State&)>;
 
     Impl _parser;
+    uint32_t _id = 0;
 
 public:
     static Forward Decl(Impl&&);
@@ -213,67 +656,467 @@ private:
 
 
 
+/*
+ * Statically dispatched recursion. Rec<Name> parses with the grammar that
+ * `grammar(Name)` returns, found by argument dependent lookup:
+ *
+ *     struct Expr {};
+ *     inline auto grammar(Expr) {
+ *         return Atom(NUM) | (Atom(OPEN) + Rec<Expr>() + Atom(CLOSE));
+ *     }
+ *
+ * Every combinator keeps its concrete, final type, so calls are resolved at
+ * compile time and can be inlined; nothing is cloned onto the heap. The
+ * grammar is built once, on first use.
+ */
+template <typename Name> class Rec final : public IParser {
+public:
+    Rec() = default;
+    ~Rec() override = default;
+
+    State operator () (State state) const override {
+        uint32_t outer = 0;
+        if (recall(id(), state, outer)) return state;
+        State result = rule()(state);
+        remember(id(), state, result, outer);
+        return result;
+    }
+
+    IParser* clone() const override { return new Rec; }
+    bool is_valid() const override { return true; }
+
+    void compile(Compiler& compiler) const override {
+        const size_t recalled = compiler.emit(Op::RECALL, id());
+        compiler.call(rule());
+        compiler.emit(Op::REMEMBER, id());
+        compiler.patch(recalled);
+    }
+
+    First first() const override { return first_of(rule()); }
+
+private:
+    static const auto& rule() {
+        static const auto parser = grammar(Name{});
+        return parser;
+    }
+
+    static uint32_t id() {
+        static const uint32_t id = unique_id();
+        return id;
+    }
+};
+
+
+
+/*
+ * Reference to a parser defined elsewhere, typically one that refers to
+ * itself. Unlike Forward it can be compiled, so recursion through it runs
+ * on the VM without using the native stack:
+ *
+ *     Parser sum;
+ *     sum = (Atom(NUM) + Atom(ADD) + Ref(sum)) | Atom(NUM);
+ *
+ * The referenced parser must outlive every copy of the reference.
+ */
+class Ref final : public IParser {
+    const IParser* _target = nullptr;
+
+public:
+    Ref() = default;
+    Ref(const IParser& target) : IParser(), _target(&target) {}
+    ~Ref() override = default;
+
+    State operator () (State state) const override {
+        return (*_target)(state);
+    }
+
+    IParser* clone() const override { return new Ref(*this); }
+    bool is_valid() const override { return _target != nullptr; }
+    void compile(Compiler& compiler) const override {
+        compiler.call(*_target);
+    }
+    First first() const override { return first_of(*_target); }
+};
+
+
+
+/*
+ * Ordered choice between any number of alternatives, like a chain of Or,
+ * that only tries the alternatives whose FIRST set admits the next token.
+ * The candidates per tag are looked up in a table built on first use, so
+ * a wide statement dispatch costs one lookup instead of a probe per
+ * alternative. Alternatives that are skipped don't run their actions.
+ */
+class Choice final : public IParser {
+    // candidates of tag t are candidates[offsets[t]..offsets[t + 1]),
+    // tags past the table only get the alternatives that take any token
+    struct Table {
+        std::once_flag built;
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> candidates;
+        std::vector<uint32_t> fallback;
+        std::vector<Tag> tags;      // sorted, those of all alternatives
+    };
+
+    std::vector<std::shared_ptr<const IParser>> _alternatives;
+    std::shared_ptr<Table> _table = std::make_shared<Table>();
+
+public:
+    Choice() = default;
+    Choice(const std::vector<Parser>& alternatives);
+    template <parser_c ... Alternatives>
+    Choice(const Alternatives& ... alternatives)
+        : IParser()
+        , _alternatives{std::make_shared<const Alternatives>(alternatives)...}
+    {}
+    ~Choice() override = default;
+
+    State operator () (State) const override;
+    IParser* clone() const override { return new Choice(*this); }
+    bool is_valid() const override;
+    void compile(Compiler&) const override;
+    First first() const override;
+
+    size_t size() const { return _alternatives.size(); }
+
+private:
+    const Table& table() const;
+    std::pair<const uint32_t*, const uint32_t*> candidates(Tag) const;
+};
+
+
+
+enum class Assoc { Left, Right };
+
+
+/*
+ * Operator precedence expressions over a primary parser, parsed in a single
+ * pass by precedence climbing. Higher precedence binds tighter:
+ *
+ *     Operators expr = Operators(number)
+ *         .infix(ADD, 1, Assoc::Left, before_action<BinOp>, accept_action)
+ *         .infix(POW, 2, Assoc::Right, before_action<BinOp>, accept_action)
+ *         .prefix(SUB, 3, before_action<Neg>, accept_action);
+ *
+ * The hooks run once the operator token is matched. A node opened by the
+ * hook of an infix or postfix operator adopts the operand parsed before
+ * it, so the usual tree actions build the expression tree. An infix
+ * operator that has no right operand is left unparsed.
+ */
+class Operators final : public IParser {
+    struct Operator {
+        unsigned precedence = 0;    // zero when the tag is no such operator
+        Assoc assoc = Assoc::Left;
+        Action before;
+        Action on_accept;
+    };
+
+    Parser _primary;
+    std::vector<Operator> _prefix;
+    std::vector<Operator> _infix;
+    std::vector<Operator> _postfix;
+
+public:
+    Operators() = default;
+    Operators(const Parser& primary) : IParser(), _primary(primary) {}
+    ~Operators() override = default;
+
+    State operator () (State state) const override { return climb(state, 0); }
+    IParser* clone() const override { return new Operators(*this); }
+    bool is_valid() const override { return _primary.is_valid(); }
+    First first() const override;
+
+    Operators& prefix(Tag, unsigned precedence, Action before={},
+                      Action on_accept={});
+    Operators& infix(Tag, unsigned precedence, Assoc=Assoc::Left,
+                     Action before={}, Action on_accept={});
+    Operators& postfix(Tag, unsigned precedence, Action before={},
+                       Action on_accept={});
+
+private:
+    State climb(State, unsigned min) const;
+    State open(const Operator&, State, TreeBuilder::Mark operand) const;
+};
+
+
+
 template <parser_c Left, parser_c Right>
 inline And<Left, Right> operator + (Left left, Right right) {
-    return And<Left, Right> { left, right };
+    return And<Left, Right> { std::move(left), std::move(right) };
 }
 
 
 template <parser_c Left, parser_c Right>
 inline Or<Left, Right> operator | (Left left, Right right) {
-    return Or<Left, Right> { left, right };
+    return Or<Left, Right> { std::move(left), std::move(right) };
 }
 
 
+/*
+ * The state of one parse at a time: the packrat table, the tokens adapted
+ * from Lexems, the tree under construction and where the last parse
+ * stopped or why it was rejected. A Driver holds none of it, so threads
+ * can share one Driver as long as each brings its own Session.
+ */
+class Session {
+    friend class Driver;
+
+    TokenStream _tokens;
+    Memo _memo;
+    size_t _packrat = 0;    // bytes `_memo` was made for
+    Context _context;
+    State _finish;
+    Failure _failure;
+
+public:
+    Session() = default;
+    // the context and the finish state point into the session
+    Session(const Session&) = delete;
+    Session& operator = (const Session&) = delete;
+
+    const State& finish() const { return _finish; }
+    // why the last parse was rejected, stale after an accepted one
+    const Failure& failure() const { return _failure; }
+};
+
+
+
+/*
+ * Parses token streams with one grammar. The grammar, its bytecode and the
+ * packrat setting are fixed once packrat() and compile() have been called;
+ * the overloads taking a Session are const and may run concurrently on one
+ * Driver. The overloads without one use a session owned by the driver and
+ * are meant for a single thread.
+ */
 class Driver {
     Parser _parser;
-    State _finish;
+    Program _program;
+    size_t _packrat = 0;
+    Session _session;
 
 public:
     Driver() = default;
     Driver(const Parser& parser) : _parser(parser) {}
+    Driver(const Driver& other)
+        : _parser(other._parser)
+        , _program(other._program)
+        , _packrat(other._packrat)
+    {}
 
-    bool accept(const Lexems&, AST* = nullptr);
-    SyntaxTree parse(const Lexems&, AST* = nullptr);
+    // Packrat mode: the outcome of every Parser and Forward is cached per
+    // token position in a table of at most `bytes`, making parsing linear
+    // for backtracking grammars. A cached outcome is replayed without
+    // running actions or building trees again, so use it for grammars
+    // whose actions have no side effects. Zero bytes turns it off.
+    Driver& packrat(size_t bytes=Memo::default_size);
+    // Compiles the parser to bytecode and runs it on the VM from now on.
+    // Forward parsers stay native; use Rec or Ref for deep recursion.
+    Driver& compile();
+
+    bool accept(Session&, const TokenStream&, AST* = nullptr) const;
+    SyntaxTree parse(Session&, const TokenStream&, AST* = nullptr) const;
+    // Lexems are adapted to a TokenStream owned by the session
+    bool accept(Session&, const Lexems&, AST* = nullptr) const;
+    SyntaxTree parse(Session&, const Lexems&, AST* = nullptr) const;
+    // Nodes are made in `arena` and live until it is released
+    SyntaxTree parse(Session&, const TokenStream&, Arena&,
+                     AST* = nullptr) const;
+    // Fills `tree` from the Parsers that have a kind, empty on failure
+    bool parse(Session&, const TokenStream&, FlatTree& tree) const;
+    // Same, copying the subtrees an edit left intact from an earlier tree
+    bool parse(Session&, const TokenStream&, FlatTree& tree,
+               const Reuse&) const;
+    // Lexes from `source` only as far as the parse reads, so a rejected
+    // input stops lexing where the parse gave up and a byte no rule
+    // matches is reported as a failure at its offset. A compiled accept
+    // lets the source forget the tokens no alternative can return to.
+    bool accept(Session&, TokenSource& source) const;
+    bool parse(Session&, TokenSource& source, FlatTree& tree) const;
+
+    bool accept(const TokenStream& input, AST* tree=nullptr) {
+        return accept(_session, input, tree);
+    }
+    SyntaxTree parse(const TokenStream& input, AST* tree=nullptr) {
+        return parse(_session, input, tree);
+    }
+    bool accept(const Lexems& input, AST* tree=nullptr) {
+        return accept(_session, input, tree);
+    }
+    SyntaxTree parse(const Lexems& input, AST* tree=nullptr) {
+        return parse(_session, input, tree);
+    }
+    SyntaxTree parse(const TokenStream& input, Arena& arena,
+                     AST* tree=nullptr) {
+        return parse(_session, input, arena, tree);
+    }
+    bool parse(const TokenStream& input, FlatTree& tree) {
+        return parse(_session, input, tree);
+    }
+    bool parse(const TokenStream& input, FlatTree& tree,
+               const Reuse& reuse) {
+        return parse(_session, input, tree, reuse);
+    }
+    bool accept(TokenSource& source) { return accept(_session, source); }
+    bool parse(TokenSource& source, FlatTree& tree) {
+        return parse(_session, source, tree);
+    }
 
-    const State& finish() const { return _finish; }
+    // where the last parse through the driver's own session stopped, and
+    // why it was rejected
+    const State& finish() const { return _session.finish(); }
+    const Failure& failure() const { return _session.failure(); }
     const Parser& parser() const { return _parser; }
+    const Program& program() const { return _program; }
 
 private:
-    bool is_accept(const State&) const;
+    // an empty input is rejected without running the parser
+    static bool empty(Session&, const TokenStream&);
+    static bool empty(Session&, TokenSource&);
+    // fills the session's failure after a rejected parse
+    static void fail(Session&);
+    bool run(Session&, const TokenStream&, AST*, Arena* = nullptr,
+             FlatTree* = nullptr, const Reuse* = nullptr,
+             TokenSource* = nullptr) const;
+};
+
+
+
+struct NoAction {
+    void operator () (State&) const {}
 };
 
+
+/*
+ * Statically typed actions around a parser. The hooks are stored inline,
+ * called directly and cost nothing when left as NoAction:
+ *
+ *     auto num = Act(Atom(NUM)).on_accept(MakeLeaf<NumAST>());
+ *
+ * Like Parser, a failed Act rolls back the tree built since it started.
+ */
+template <parser_c P, typename Before=NoAction, typename Accept=NoAction,
+          typename Fail=NoAction>
+class Act final : public IParser {
+    P _parser;
+    [[no_unique_address]] Before _before;
+    [[no_unique_address]] Accept _on_accept;
+    [[no_unique_address]] Fail _on_fail;
+
+    // A failed parser leaves no tree behind, so only what the before and
+    // fail hooks built needs rolling back
+    static constexpr bool undone = !std::is_same_v<Before, NoAction> ||
+                                   !std::is_same_v<Fail, NoAction>;
+
+public:
+    Act(P parser, Before before={}, Accept on_accept={}, Fail on_fail={})
+        : IParser()
+        , _parser(parser)
+        , _before(before)
+        , _on_accept(on_accept)
+        , _on_fail(on_fail)
+    {}
+
+    State operator () (State state) const override {
+        if constexpr (!undone) {
+            State result = _parser(state);
+            if (result.accept) { _on_accept(result); }
+            return result;
+        } else {
+            const TreeBuilder::Mark mark = state.tree().mark();
+            _before(state);
+            State result = _parser(state);
+            if (result.accept) {
+                _on_accept(result);
+            } else {
+                _on_fail(result);
+                result.tree().rollback(mark);
+            }
+            return result;
+        }
+    }
+
+    IParser* clone() const override { return new Act(*this); }
+    bool is_valid() const override { return _parser.is_valid(); }
+    First first() const override { return _parser.first(); }
+
+    void compile(Compiler& compiler) const override {
+        if constexpr (undone) { compiler.emit(Op::ENTER, Program::none); }
+        if constexpr (!std::is_same_v<Before, NoAction>) {
+            compiler.emit(Op::ACTION, compiler.action(_before));
+        }
+        _parser.compile(compiler);
+        const uint32_t on_accept = hook(compiler, _on_accept);
+        const uint32_t on_fail = hook(compiler, _on_fail);
+        if (on_accept != Program::none || on_fail != Program::none) {
+            compiler.emit(Op::HOOK, on_accept, on_fail);
+        }
+        if constexpr (undone) { compiler.emit(Op::EXIT); }
+    }
+
+    template <typename F> Act<P, F, Accept, Fail> on_before(F f) const {
+        return {_parser, f, _on_accept, _on_fail};
+    }
+    template <typename F> Act<P, Before, F, Fail> on_accept(F f) const {
+        return {_parser, _before, f, _on_fail};
+    }
+    template <typename F> Act<P, Before, Accept, F> on_disaccept(F f) const {
+        return {_parser, _before, _on_accept, f};
+    }
+
+private:
+    template <typename F>
+    static uint32_t hook(Compiler& compiler, const F& action) {
+        if constexpr (std::is_same_v<F, NoAction>) return Program::none;
+        else return compiler.action(action);
+    }
+};
+
+
+// Appends a leaf made from the last matched token and `args`.
+template <typename Tree, typename ... Args> struct MakeLeaf {
+    std::tuple<Args...> args;
+
+    void operator () (State& state) const {
+        const auto content = state.tokens().content(state.position - 1);
+        TreeBuilder& tree = state.tree();
+        std::apply([&](const Args& ... args) {
+            tree.append(tree.make<Tree>(std::string(content), args ...));
+        }, args);
+    }
+};
+
+
+// Opens a node of type Tree, the cursor moves into it.
+template <typename Tree> struct OpenNode {
+    void operator () (State& state) const {
+        state.tree().open(state.tree().make<Tree>());
+    }
+};
+
+
+struct CloseNode {
+    void operator () (State& state) const { state.tree().close(); }
+};
+
+
 template<typename Tree, typename ... Args>
 inline Action primary_type_builder(Args ... args) {
-    return [args...](State& state) {
-        CLIterator target = state.current - 1;
-        AST* tree = new Tree(target->content, args ...);
-        tree->parent(state.tree.cursor());
-        state.tree.append(tree);
-    };
+    return MakeLeaf<Tree, Args...>{{args...}};
 }
 
 
 template<typename Tree> inline void before_action(State& state) {
-    Tree* candidate = new Tree;
-    state.tree.append(candidate);
-    candidate->parent(state.tree.cursor());
-    state.tree.cursor(candidate);
+    OpenNode<Tree>()(state);
 }
 
 
 inline void accept_action(State& state) {
-    state.tree.cursor(state.tree.cursor()->parent());
+    CloseNode()(state);
 }
 
 
-inline void disaccept_action(State& state) {
-    AST* to_delete = state.tree.cursor();
-    AST* parent = to_delete->parent();
-    state.tree.cursor(parent);
-    if (parent) {
-        parent->pop(to_delete);
-    }
-}
+// A failed Parser rolls back everything built since it started, so there
+// is nothing left to undo here.
+inline void disaccept_action(State&) {}
 
 }
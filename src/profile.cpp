@@ -0,0 +1,301 @@
+#include <tuple>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "profile.hpp"
+
+using namespace parselib;
+
+
+
+std::mutex Profile::_labels_mutex;
+std::unordered_map<uint32_t, std::string> Profile::_labels;
+
+
+Profile::Counters& Profile::Counters::operator += (const Counters& other) {
+    calls += other.calls;
+    accepts += other.accepts;
+    backtracks += other.backtracks;
+    retried += other.retried;
+    return *this;
+}
+
+
+Profile::Scope::Scope(Profile& profile) : _previous(_active) {
+    _active = &profile;
+    profile._clock = clock();
+}
+
+
+Profile::Scope::~Scope() {
+    if (_active->_timing) { _active->tick(); }
+    _active = _previous;
+}
+
+
+Profile::Profile(bool timing) : _timing(timing) {}
+
+
+uint64_t Profile::clock() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || \
+    defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+
+void Profile::label(uint32_t id, std::string name) {
+    // folded stacks are split on ';' and ' '
+    std::replace(name.begin(), name.end(), ';', '_');
+    std::replace(name.begin(), name.end(), ' ', '_');
+    std::lock_guard lock(_labels_mutex);
+    _labels[id] = std::move(name);
+}
+
+
+std::string Profile::label(uint32_t id) {
+    if (id == none) return "root";
+    std::lock_guard lock(_labels_mutex);
+    const auto found = _labels.find(id);
+    return found != _labels.end() ? found->second
+                                  : "parser#" + std::to_string(id);
+}
+
+
+void Profile::tick() {
+    const uint64_t now = clock();
+    _frames[_stack.back()].cycles += now - _clock;
+    _clock = now;
+}
+
+
+uint32_t Profile::child(uint32_t parent, uint32_t id) {
+    const uint64_t key = uint64_t(parent) << 32 | id;
+    const auto [found, added] = _children.try_emplace(key, _frames.size());
+    if (added) {
+        Frame frame;
+        frame.id = id;
+        frame.parent = parent;
+        _frames.push_back(frame);
+    }
+    return found->second;
+}
+
+
+void Profile::enter(uint32_t id) {
+    if (_timing) { tick(); }
+    // recursion goes back into the frame that is already open
+    auto& [frame, depth] = _open[id];
+    if (depth++ == 0) { frame = child(_stack.back(), id); }
+    _stack.push_back(frame);
+    _entered.push_back(_consumed);
+    ++_frames[frame].counters.calls;
+}
+
+
+void Profile::exit(bool accept) {
+    if (_stack.size() == 1) return;
+    if (_timing) { tick(); }
+    Frame& frame = _frames[_stack.back()];
+    Counters& counters = frame.counters;
+    if (accept) {
+        ++counters.accepts;
+    } else {
+        ++counters.backtracks;
+        counters.retried += _consumed - _entered.back();
+    }
+    _stack.pop_back();
+    _entered.pop_back();
+
+    const auto open = _open.find(frame.id);
+    if (--open->second.second == 0) { _open.erase(open); }
+}
+
+
+void Profile::sequence(bool accept, uint64_t start) {
+    Counters& counters = _frames[_stack.back()].sequences;
+    ++counters.calls;
+    if (accept) {
+        ++counters.accepts;
+    } else {
+        ++counters.backtracks;
+        counters.retried += _consumed - start;
+    }
+}
+
+
+void Profile::retry(uint64_t start) {
+    Counters& counters = _frames[_stack.back()].choices;
+    ++counters.backtracks;
+    counters.retried += _consumed - start;
+}
+
+
+void Profile::choice(bool accept) {
+    Counters& counters = _frames[_stack.back()].choices;
+    ++counters.calls;
+    counters.accepts += accept;
+}
+
+
+Profile::Rule& Profile::rule(const void* lexer, uint32_t index,
+                             const std::string& name) {
+    const auto [found, added] = _rules.try_emplace({lexer, index});
+    if (added) { found->second.name = name; }
+    return found->second;
+}
+
+
+Profile& Profile::merge(const Profile& other) {
+    // parents come before their children in both trees
+    std::vector<uint32_t> frames(other._frames.size(), 0);
+    for (uint32_t index = 1; index < other._frames.size(); ++index) {
+        const Frame& from = other._frames[index];
+        frames[index] = child(frames[from.parent], from.id);
+        Frame& into = _frames[frames[index]];
+        into.counters += from.counters;
+        into.sequences += from.sequences;
+        into.choices += from.choices;
+        into.cycles += from.cycles;
+    }
+    _frames[0].cycles += other._frames[0].cycles;
+    _frames[0].sequences += other._frames[0].sequences;
+    _frames[0].choices += other._frames[0].choices;
+
+    for (const auto& [key, from] : other._rules) {
+        Rule& into = rule(key.first, key.second, from.name);
+        into.attempts += from.attempts;
+        into.hits += from.hits;
+        into.bytes += from.bytes;
+        into.cycles += from.cycles;
+        into.automaton = from.automaton;
+    }
+    _consumed += other._consumed;
+    return *this;
+}
+
+
+void Profile::clear() {
+    *this = Profile(_timing);
+}
+
+
+Profile::Counters Profile::total(uint32_t id) const {
+    Counters total;
+    for (const Frame& frame : _frames) {
+        if (frame.id == id) { total += frame.counters; }
+    }
+    return total;
+}
+
+
+std::string Profile::path(uint32_t frame) const {
+    std::vector<uint32_t> ids;
+    for (; frame != none; frame = _frames[frame].parent) {
+        ids.push_back(_frames[frame].id);
+    }
+    std::string path;
+    for (auto id = ids.rbegin(); id != ids.rend(); ++id) {
+        path += (path.empty() ? "" : ";") + label(*id);
+    }
+    return path;
+}
+
+
+void Profile::report(std::ostream& os) const {
+    const auto row = [&os](const std::string& name) -> std::ostream& {
+        return os << "  " << std::left << std::setw(28) << name
+                  << std::right;
+    };
+
+    os << "rules" << std::string(25, ' ') << std::setw(12) << "attempts"
+       << std::setw(12) << "hits" << std::setw(14) << "bytes"
+       << std::setw(16) << "cycles" << "\n";
+    for (const auto& [key, rule] : _rules) {
+        row(rule.name);
+        // rules of the automaton are all tried by each of its scans
+        const auto automaton = _rules.find({key.first, none});
+        const uint64_t attempts = rule.automaton && automaton != _rules.end()
+                                ? automaton->second.attempts : rule.attempts;
+        os << std::setw(12) << attempts << std::setw(12) << rule.hits
+           << std::setw(14) << rule.bytes << std::setw(16)
+           << (rule.automaton ? "-" : std::to_string(rule.cycles)) << "\n";
+    }
+
+    // parsers summed over their calling contexts, the most retried first
+    struct Total {
+        uint32_t id;
+        Counters counters, sequences, choices;
+        uint64_t cycles = 0;
+    };
+    std::vector<Total> totals;
+    std::unordered_map<uint32_t, size_t> index;
+    for (const Frame& frame : _frames) {
+        const auto [found, added] = index.try_emplace(frame.id,
+                                                      totals.size());
+        if (added) { totals.push_back(Total{frame.id, {}, {}, {}}); }
+        Total& total = totals[found->second];
+        total.counters += frame.counters;
+        total.sequences += frame.sequences;
+        total.choices += frame.choices;
+        total.cycles += frame.cycles;
+    }
+    std::sort(totals.begin(), totals.end(), [](const Total& a,
+                                               const Total& b) {
+        const auto key = [](const Total& total) {
+            return std::make_tuple(total.counters.retried +
+                                   total.sequences.retried +
+                                   total.choices.retried,
+                                   total.counters.calls, total.cycles);
+        };
+        return key(a) > key(b);
+    });
+
+    os << "parsers" << std::string(23, ' ') << std::setw(12) << "calls"
+       << std::setw(12) << "accepts" << std::setw(14) << "backtracks"
+       << std::setw(16) << "retried" << std::setw(16) << "self cycles"
+       << "\n";
+    const auto counters = [&](const Counters& counters) -> std::ostream& {
+        return os << std::setw(12) << counters.calls << std::setw(12)
+                  << counters.accepts << std::setw(14) << counters.backtracks
+                  << std::setw(16) << counters.retried;
+    };
+    for (const Total& total : totals) {
+        row(label(total.id));
+        counters(total.counters) << std::setw(16) << total.cycles << "\n";
+        if (total.sequences.calls) {
+            row("  and");
+            counters(total.sequences) << "\n";
+        }
+        if (total.choices.calls) {
+            row("  or");
+            counters(total.choices) << "\n";
+        }
+    }
+}
+
+
+void Profile::folded(std::ostream& os, Weight weight) const {
+    for (uint32_t index = 0; index < _frames.size(); ++index) {
+        const Frame& frame = _frames[index];
+        uint64_t value = 0;
+        switch (weight) {
+        case Weight::Cycles: value = frame.cycles; break;
+        case Weight::Calls: value = frame.counters.calls; break;
+        case Weight::Retried:
+            value = frame.counters.retried + frame.sequences.retried +
+                    frame.choices.retried;
+            break;
+        }
+        if (value != 0) { os << path(index) << " " << value << "\n"; }
+    }
+}
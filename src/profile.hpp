@@ -0,0 +1,200 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+
+namespace parselib {
+
+#if defined(PARSELIB_PROFILE)
+inline constexpr bool profiling = true;
+#else
+inline constexpr bool profiling = false;
+#endif
+
+
+/*
+ * Counters of the lexer rules and parsers that ran on a thread, collected
+ * while a Profile::Scope is alive. The probes in Lexer, the combinators and
+ * the VM are compiled in only with PARSELIB_PROFILE defined; without it
+ * they compile to nothing and a profile stays empty.
+ *
+ * Parser and Forward calls form a tree of frames by calling context, with
+ * recursion folded into the frame already open for the same parser, so it
+ * prints as a flame graph. And and Or are counted in the frame they run
+ * in. Tokens a failed attempt had consumed are counted as retried: they
+ * are parsed again by whatever is tried next, so a high count points at
+ * backtracking. The VM runs And and Or as plain bytecode and only reports
+ * its Parser frames.
+ */
+class Profile {
+public:
+    static constexpr uint32_t none = UINT32_MAX;
+
+    struct Counters {
+        uint64_t calls = 0;
+        uint64_t accepts = 0;
+        uint64_t backtracks = 0;    // failed, or for Or, fell through to right
+        uint64_t retried = 0;       // tokens consumed by failed attempts
+
+        Counters& operator += (const Counters&);
+    };
+
+    struct Rule {
+        std::string name;
+        uint64_t attempts = 0;
+        uint64_t hits = 0;
+        uint64_t bytes = 0;         // bytes of the tokens it produced
+        uint64_t cycles = 0;
+        bool automaton = false;     // tried by the Scanner or the trie
+    };
+
+    struct Frame {
+        uint32_t id = none;         // id of the Parser or Forward
+        uint32_t parent = none;
+        Counters counters;
+        Counters sequences;         // And run directly in the frame
+        Counters choices;           // Or run directly in the frame
+        uint64_t cycles = 0;        // spent in the frame itself
+    };
+
+    // what a line of the folded stacks weighs
+    enum class Weight { Cycles, Calls, Retried };
+
+    // Installs a profile on this thread for as long as it lives
+    class Scope {
+        Profile* _previous;
+
+    public:
+        explicit Scope(Profile&);
+        Scope(const Scope&) = delete;
+        Scope& operator = (const Scope&) = delete;
+        ~Scope();
+    };
+
+private:
+    // rules by lexer and rule index, the automaton under none
+    std::map<std::pair<const void*, uint32_t>, Rule> _rules;
+    std::vector<Frame> _frames{Frame{}};
+    std::unordered_map<uint64_t, uint32_t> _children;
+    // open frames, with the tokens consumed when each was entered
+    std::vector<uint32_t> _stack{0};
+    std::vector<uint64_t> _entered{0};
+    // frame and depth of every parser on the stack
+    std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>> _open;
+    uint64_t _consumed = 0;
+    uint64_t _clock = 0;
+    bool _timing;
+
+    static inline thread_local Profile* _active = nullptr;
+    static std::mutex _labels_mutex;
+    static std::unordered_map<uint32_t, std::string> _labels;
+
+public:
+    // with `timing` frames and std::regex rules are timed in cycles
+    explicit Profile(bool timing=false);
+
+    // the profile installed on this thread, if any
+    static Profile* current() { return _active; }
+    static uint64_t clock();
+    // names the parser `id` in reports, Parser::name calls it
+    static void label(uint32_t id, std::string name);
+    static std::string label(uint32_t id);
+
+    bool timing() const { return _timing; }
+    uint64_t consumed() const { return _consumed; }
+
+    void consume(uint64_t tokens) { _consumed += tokens; }
+    void enter(uint32_t id);
+    void exit(bool accept);
+    void sequence(bool accept, uint64_t start);
+    void choice(bool accept);
+    // the left alternative of an Or failed after consuming from `start`
+    void retry(uint64_t start);
+    Rule& rule(const void* lexer, uint32_t index, const std::string& name);
+    // charges the cycles since the last event to the open frame
+    void tick();
+
+    // adds the counts of `other`, matching frames by calling context
+    Profile& merge(const Profile& other);
+    void clear();
+
+    const std::map<std::pair<const void*, uint32_t>, Rule>& rules() const {
+        return _rules;
+    }
+    const std::vector<Frame>& frames() const { return _frames; }
+    // the counters of parser `id` summed over its calling contexts
+    Counters total(uint32_t id) const;
+
+    // rules and parsers, the busiest first
+    void report(std::ostream&) const;
+    // one "root;outer;inner weight" line per frame, for flamegraph.pl
+    void folded(std::ostream&, Weight=Weight::Cycles) const;
+
+private:
+    uint32_t child(uint32_t parent, uint32_t id);
+    std::string path(uint32_t frame) const;
+};
+
+
+
+// The probes the library calls, empty unless profiling is compiled in.
+namespace probe {
+
+inline Profile* current() {
+    if constexpr (profiling) return Profile::current();
+    else return nullptr;
+}
+
+inline uint64_t start() {
+    if constexpr (profiling) {
+        if (Profile* profile = Profile::current()) return profile->consumed();
+    }
+    return 0;
+}
+
+inline void consume(uint64_t tokens) {
+    if constexpr (profiling) {
+        if (Profile* profile = Profile::current()) profile->consume(tokens);
+    }
+}
+
+inline void enter(uint32_t id) {
+    if constexpr (profiling) {
+        if (Profile* profile = Profile::current()) profile->enter(id);
+    }
+}
+
+inline void exit(bool accept) {
+    if constexpr (profiling) {
+        if (Profile* profile = Profile::current()) profile->exit(accept);
+    }
+}
+
+inline void sequence(bool accept, uint64_t start) {
+    if constexpr (profiling) {
+        if (Profile* profile = Profile::current()) {
+            profile->sequence(accept, start);
+        }
+    }
+}
+
+inline void retry(uint64_t start) {
+    if constexpr (profiling) {
+        if (Profile* profile = Profile::current()) profile->retry(start);
+    }
+}
+
+inline void choice(bool accept) {
+    if constexpr (profiling) {
+        if (Profile* profile = Profile::current()) profile->choice(accept);
+    }
+}
+
+}
+
+}
@@ -0,0 +1,625 @@
+#include <map>
+#include <bitset>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+
+#include "scanner.hpp"
+
+using namespace parselib;
+
+
+
+namespace {
+
+using ByteSet = std::bitset<256>;
+
+inline unsigned char uchar(char code) {
+    return static_cast<unsigned char>(code);
+}
+
+constexpr size_t NFA_LIMIT = 1 << 16;
+constexpr size_t DFA_LIMIT = 1 << 13;
+constexpr uint32_t REPEAT_LIMIT = 1000;
+
+struct Unsupported {};
+
+
+ByteSet range(unsigned char from, unsigned char to) {
+    ByteSet set;
+    for (unsigned code = from; code <= to; ++code) { set.set(code); }
+    return set;
+}
+
+
+ByteSet digits() { return range('0', '9'); }
+ByteSet words() {
+    return digits() | range('a', 'z') | range('A', 'Z') | range('_', '_');
+}
+ByteSet spaces() { return range('\t', '\r') | range(' ', ' '); }
+ByteSet anything() { return ~(range('\n', '\n') | range('\r', '\r')); }
+
+
+struct Nfa {
+    struct Node {
+        ByteSet set;
+        int32_t next = -1;
+        std::vector<int32_t> epsilon;     // in the order std::regex tries
+        uint32_t accept = Scanner::none;
+        uint32_t pattern = Scanner::none;
+    };
+
+    std::vector<Node> nodes;
+
+    int32_t node() {
+        if (nodes.size() >= NFA_LIMIT) throw Unsupported{};
+        nodes.emplace_back();
+        return static_cast<int32_t>(nodes.size() - 1);
+    }
+
+    void link(int32_t from, int32_t to) { nodes[from].epsilon.push_back(to); }
+};
+
+
+struct Fragment {
+    int32_t start;
+    int32_t end;
+    bool nullable;      // matches the empty string
+};
+
+
+// Recursive descent over the supported ECMAScript subset, emitting a
+// Thompson NFA. Anything outside the subset throws Unsupported.
+class Syntax {
+    Nfa& _nfa;
+    const std::string& _source;
+    size_t _pos = 0;
+
+public:
+    Syntax(Nfa& nfa, const std::string& source) : _nfa(nfa), _source(source) {}
+
+    Fragment parse() {
+        Fragment fragment = alternation();
+        if (_pos != _source.size()) throw Unsupported{};
+        return fragment;
+    }
+
+private:
+    bool done() const { return _pos >= _source.size(); }
+    char peek() const { return done() ? '\0' : _source[_pos]; }
+
+    char take() {
+        if (done()) throw Unsupported{};
+        return _source[_pos++];
+    }
+
+    Fragment empty() {
+        const int32_t node = _nfa.node();
+        return {node, node, true};
+    }
+
+    Fragment set(const ByteSet& bytes) {
+        const int32_t start = _nfa.node(), end = _nfa.node();
+        _nfa.nodes[start].set = bytes;
+        _nfa.nodes[start].next = end;
+        return {start, end, false};
+    }
+
+    Fragment concat(Fragment left, Fragment right) {
+        _nfa.link(left.end, right.start);
+        return {left.start, right.end, left.nullable && right.nullable};
+    }
+
+    Fragment optional(Fragment inner) {
+        const int32_t start = _nfa.node(), end = _nfa.node();
+        _nfa.link(start, inner.start);
+        _nfa.link(start, end);
+        _nfa.link(inner.end, end);
+        return {start, end, true};
+    }
+
+    Fragment star(Fragment inner) {
+        const int32_t start = _nfa.node(), end = _nfa.node();
+        _nfa.link(start, inner.start);
+        _nfa.link(start, end);
+        _nfa.link(inner.end, inner.start);
+        _nfa.link(inner.end, end);
+        return {start, end, true};
+    }
+
+    Fragment alternation() {
+        Fragment first = sequence();
+        if (peek() != '|') return first;
+
+        const int32_t start = _nfa.node(), end = _nfa.node();
+        _nfa.link(start, first.start);
+        _nfa.link(first.end, end);
+        bool nullable = first.nullable;
+        while (peek() == '|') {
+            take();
+            Fragment next = sequence();
+            _nfa.link(start, next.start);
+            _nfa.link(next.end, end);
+            nullable = nullable || next.nullable;
+        }
+        return {start, end, nullable};
+    }
+
+    Fragment sequence() {
+        Fragment result = empty();
+        while (!done() && peek() != '|' && peek() != ')') {
+            result = concat(result, repetition());
+        }
+        return result;
+    }
+
+    Fragment repetition() {
+        const size_t from = _pos;
+        Fragment inner = atom();
+
+        uint32_t min = 1, max = 1;
+        switch (peek()) {
+        case '*': take(); min = 0; max = UINT32_MAX; break;
+        case '+': take(); min = 1; max = UINT32_MAX; break;
+        case '?': take(); min = 0; max = 1; break;
+        case '{': take(); bounds(min, max); break;
+        default: return inner;
+        }
+        // lazy and stacked quantifiers change std::regex semantics, and so
+        // do repeats of what may match nothing, as std::regex cuts an empty
+        // iteration short in ways a plain loop doesn't
+        if (peek() == '?' || peek() == '*' || peek() == '+' || peek() == '{' ||
+            inner.nullable) {
+            throw Unsupported{};
+        }
+
+        const size_t to = _pos;
+        auto copy = [&]() {
+            _pos = from;
+            Fragment fragment = atom();
+            _pos = to;
+            return fragment;
+        };
+
+        Fragment result = min == 0 ? empty() : inner;
+        for (uint32_t index = 1; index < min; ++index) {
+            result = concat(result, copy());
+        }
+        if (max == UINT32_MAX) {
+            return min == 0 ? star(inner) :
+                   concat(result, star(copy()));
+        }
+        // x{0,3} is tried as (x(x(x)?)?)?, a copy only after the one before
+        if (min == max) return result;
+        Fragment rest = min == 0 && max == 1 ? inner : copy();
+        for (uint32_t index = max - 1; index-- > min;) {
+            Fragment next = min == 0 && index == 0 ? inner : copy();
+            rest = concat(next, optional(rest));
+        }
+        return concat(result, optional(rest));
+    }
+
+    void bounds(uint32_t& min, uint32_t& max) {
+        min = number();
+        max = min;
+        if (peek() == ',') {
+            take();
+            max = peek() == '}' ? UINT32_MAX : number();
+        }
+        if (take() != '}' || max < min) throw Unsupported{};
+    }
+
+    uint32_t number() {
+        if (!std::isdigit(uchar(peek()))) throw Unsupported{};
+        uint32_t value = 0;
+        while (std::isdigit(uchar(peek()))) {
+            value = value * 10 + (take() - '0');
+            if (value > REPEAT_LIMIT) throw Unsupported{};
+        }
+        return value;
+    }
+
+    Fragment atom() {
+        const char head = take();
+        switch (head) {
+        case '(':
+            if (peek() == '?') {
+                take();
+                if (take() != ':') throw Unsupported{};
+            }
+            {
+                Fragment inner = alternation();
+                if (take() != ')') throw Unsupported{};
+                return inner;
+            }
+        case '[': return set(bracket());
+        case '.': return set(anything());
+        case '\\': return set(escape());
+        case '^': case '$': case ')': case '|':
+        case '*': case '+': case '?':
+        case '{': case '}': case ']':
+            throw Unsupported{};
+        default:
+            return set(range(head, head));
+        }
+    }
+
+    ByteSet bracket() {
+        bool negate = false;
+        if (peek() == '^') { take(); negate = true; }
+        if (peek() == ']') throw Unsupported{};
+
+        ByteSet result;
+        while (peek() != ']') {
+            ByteSet item = member();
+            if (peek() == '-' && _pos + 1 < _source.size() &&
+                _source[_pos + 1] != ']') {
+                take();
+                ByteSet last = member();
+                if (item.count() != 1 || last.count() != 1) throw Unsupported{};
+                const unsigned from = first(item), to = first(last);
+                if (from > to) throw Unsupported{};
+                item = range(from, to);
+            }
+            result |= item;
+        }
+        take();
+        return negate ? ~result : result;
+    }
+
+    ByteSet member() {
+        const char head = take();
+        if (head == '\\') return escape();
+        if (head == '[' && (peek() == ':' || peek() == '.' || peek() == '=')) {
+            throw Unsupported{};
+        }
+        return range(head, head);
+    }
+
+    ByteSet escape() {
+        const char head = take();
+        switch (head) {
+        case 'd': return digits();
+        case 'D': return ~digits();
+        case 'w': return words();
+        case 'W': return ~words();
+        case 's': return spaces();
+        case 'S': return ~spaces();
+        case 'n': return range('\n', '\n');
+        case 'r': return range('\r', '\r');
+        case 't': return range('\t', '\t');
+        case 'f': return range('\f', '\f');
+        case 'v': return range('\v', '\v');
+        case '0':
+            if (std::isdigit(uchar(peek()))) throw Unsupported{};
+            return range('\0', '\0');
+        case 'x': {
+            unsigned value = 0;
+            for (int index = 0; index < 2; ++index) {
+                const char digit = take();
+                if (!std::isxdigit(uchar(digit))) throw Unsupported{};
+                value = value * 16 + (std::isdigit(uchar(digit)) ?
+                        digit - '0' : std::tolower(digit) - 'a' + 10);
+            }
+            return range(value, value);
+        }
+        default:
+            // backreferences, \b, \B, \c, \u and unknown letters
+            if (std::isalnum(uchar(head))) throw Unsupported{};
+            return range(head, head);
+        }
+    }
+
+    static unsigned first(const ByteSet& set) {
+        for (unsigned code = 0; code < 256; ++code) {
+            if (set.test(code)) return code;
+        }
+        return 0;
+    }
+};
+
+
+// Follows the epsilon links of `states`, keeping the nodes that consume or
+// accept in the order std::regex would try them. Once a pattern accepts,
+// its later nodes could only lead to matches std::regex never returns, as
+// it stops at the first, so they are dropped; the earlier ones may still
+// go on to a match it prefers.
+void closure(const Nfa& nfa, std::vector<int32_t>& states) {
+    std::vector<bool> seen(nfa.nodes.size(), false);
+    std::vector<uint32_t> accepted;
+    std::vector<int32_t> stack;
+    std::vector<int32_t> ordered;
+    for (const int32_t state: states) {
+        stack.push_back(state);
+        while (!stack.empty()) {
+            const int32_t current = stack.back();
+            stack.pop_back();
+            if (seen[current]) continue;
+            seen[current] = true;
+            const Nfa::Node& node = nfa.nodes[current];
+            if (std::find(accepted.begin(), accepted.end(), node.pattern) !=
+                accepted.end()) {
+                continue;
+            }
+            if (node.next >= 0) { ordered.push_back(current); }
+            if (node.accept != Scanner::none) {
+                ordered.push_back(current);
+                accepted.push_back(node.pattern);
+            }
+            stack.insert(stack.end(), node.epsilon.rbegin(),
+                         node.epsilon.rend());
+        }
+    }
+    states = std::move(ordered);
+}
+
+}
+
+
+
+Scanner::Scanner(const std::vector<std::string>& patterns,
+                 const std::vector<bool>& skip)
+    : _supported(patterns.size(), false)
+{
+    Nfa nfa;
+    const int32_t start = nfa.node();
+    for (size_t index = 0; index < patterns.size(); ++index) {
+        if (index < skip.size() && skip[index]) continue;
+        const size_t mark = nfa.nodes.size();
+        try {
+            Fragment fragment = Syntax(nfa, patterns[index]).parse();
+            nfa.nodes[fragment.end].accept = static_cast<uint32_t>(index);
+            for (size_t node = mark; node < nfa.nodes.size(); ++node) {
+                nfa.nodes[node].pattern = static_cast<uint32_t>(index);
+            }
+            nfa.link(start, fragment.start);
+            _supported[index] = true;
+        } catch (const Unsupported&) {
+            nfa.nodes.resize(mark);
+        }
+    }
+
+    // bytes that no pattern tells apart share one column of the table
+    _classes = 1;
+    for (const Nfa::Node& node: nfa.nodes) {
+        if (node.next < 0) continue;
+        int16_t split[512];
+        std::fill(std::begin(split), std::end(split), -1);
+        uint32_t classes = 0;
+        for (unsigned code = 0; code < 256; ++code) {
+            int16_t& slot = split[_class[code] * 2 + node.set.test(code)];
+            if (slot < 0) { slot = static_cast<int16_t>(classes++); }
+            _class[code] = static_cast<uint8_t>(slot);
+        }
+        _classes = classes;
+    }
+    uint8_t sample[256] = {};
+    for (int code = 255; code >= 0; --code) { sample[_class[code]] = code; }
+
+    std::map<std::vector<int32_t>, int32_t> known;
+    std::vector<std::vector<int32_t>> pending;
+    auto intern = [&](std::vector<int32_t>& states) -> int32_t {
+        closure(nfa, states);
+        // the initial state stays even with nothing supported
+        if (states.empty() && !known.empty()) return -1;
+        auto found = known.find(states);
+        if (found != known.end()) return found->second;
+        if (known.size() >= DFA_LIMIT) throw Unsupported{};
+
+        const int32_t id = static_cast<int32_t>(_accept.size());
+        uint32_t accept = none;
+        for (int32_t state: states) {
+            accept = std::min(accept, nfa.nodes[state].accept);
+        }
+        _accept.push_back(accept);
+        _next.resize(_next.size() + _classes, -1);
+        known.emplace(states, id);
+        pending.push_back(states);
+        return id;
+    };
+
+    try {
+        std::vector<int32_t> initial{start};
+        intern(initial);
+        for (size_t id = 0; id < pending.size(); ++id) {
+            for (uint32_t column = 0; column < _classes; ++column) {
+                std::vector<int32_t> moved;
+                for (int32_t state: pending[id]) {
+                    const Nfa::Node& node = nfa.nodes[state];
+                    if (node.next >= 0 && node.set.test(sample[column])) {
+                        moved.push_back(node.next);
+                    }
+                }
+                const int32_t target = intern(moved);
+                _next[id * _classes + column] = target;
+            }
+        }
+    } catch (const Unsupported&) {
+        // the combined automaton is too large, leave everything to std::regex
+        _next.clear();
+        _accept.clear();
+        _supported.assign(patterns.size(), false);
+    }
+
+    const std::pair<simd::Run, ByteSet> runs[] = {
+        {simd::Run::Word, words()},
+        {simd::Run::Digits, digits()},
+        {simd::Run::Spaces, spaces()}
+    };
+    _runs.assign(_accept.size(), simd::Run::None);
+    for (size_t state = 0; state < _runs.size(); ++state) {
+        ByteSet loop;
+        for (unsigned code = 0; code < 256; ++code) {
+            const int32_t target = _next[state * _classes + _class[code]];
+            loop[code] = target == static_cast<int32_t>(state);
+        }
+        for (const auto& [run, bytes]: runs) {
+            if ((bytes & ~loop).none()) {
+                _runs[state] = run;
+                break;
+            }
+        }
+    }
+}
+
+
+Scanner::Scanner(const Tables& tables)
+    : _next(tables.next)
+    , _accept(tables.accept)
+    , _supported(tables.supported.begin(), tables.supported.end())
+    , _classes(tables.columns)
+{
+    for (const uint8_t run: tables.runs) {
+        _runs.push_back(static_cast<simd::Run>(run));
+    }
+    std::copy(tables.classes.begin(), tables.classes.end(), _class);
+}
+
+
+Scanner::Tables Scanner::tables() const {
+    Tables tables;
+    tables.next = _next;
+    tables.accept = _accept;
+    for (const simd::Run run: _runs) {
+        tables.runs.push_back(static_cast<uint8_t>(run));
+    }
+    tables.supported.assign(_supported.begin(), _supported.end());
+    std::copy(std::begin(_class), std::end(_class), tables.classes.begin());
+    tables.columns = _classes;
+    return tables;
+}
+
+
+Scanner::Match Scanner::scan(const char* begin, const char* end,
+                             Priority priority) const {
+    Match best;
+    if (empty()) return best;
+
+    int32_t state = 0;
+    best.truncated = true;
+    for (const char* current = begin; current != end;) {
+        const uint8_t column = _class[static_cast<uint8_t>(*current)];
+        state = _next[static_cast<size_t>(state) * _classes + column];
+        if (state < 0) {
+            best.truncated = false;
+            break;
+        }
+        // the state is the same over the whole run, so is its verdict
+        current = simd::skip(_runs[state], current + 1, end);
+
+        const uint32_t pattern = _accept[state];
+        if (pattern == none) continue;
+        if (priority == Priority::Longest || pattern <= best.pattern) {
+            best.pattern = pattern;
+            best.length = static_cast<uint64_t>(current - begin);
+        }
+    }
+    return best;
+}
+
+
+bool Scanner::supports(size_t pattern) const {
+    return !empty() && pattern < _supported.size() && _supported[pattern];
+}
+
+
+
+Literals::Literals(
+    const std::vector<std::pair<uint32_t, std::string>>& literals) {
+    // built with maps first, then laid out as sorted edge ranges
+    std::vector<std::map<uint8_t, uint32_t>> children(1);
+    _nodes.resize(1);
+    for (const auto& [pattern, text]: literals) {
+        uint32_t node = 0;
+        for (const char code: text) {
+            const uint32_t next = static_cast<uint32_t>(_nodes.size());
+            const auto [found, added] = children[node].try_emplace(
+                uchar(code), next);
+            node = found->second;
+            if (added) {
+                children.emplace_back();
+                _nodes.emplace_back();
+            }
+        }
+        // the same literal twice matches as its first rule
+        _nodes[node].accept = std::min(_nodes[node].accept, pattern);
+        if (pattern >= _patterns.size()) { _patterns.resize(pattern + 1); }
+        _patterns[pattern] = true;
+    }
+
+    for (size_t node = 0; node < _nodes.size(); ++node) {
+        _nodes[node].begin = static_cast<uint32_t>(_bytes.size());
+        for (const auto& [code, target]: children[node]) {
+            _bytes.push_back(code);
+            _targets.push_back(target);
+            if (node == 0) { _root[code] = target; }
+        }
+        _nodes[node].end = static_cast<uint32_t>(_bytes.size());
+    }
+}
+
+
+bool Literals::literal(const std::string& pattern, std::string& text) {
+    text.clear();
+    for (size_t at = 0; at < pattern.size(); ++at) {
+        const char code = pattern[at];
+        if (std::strchr("^$.*+?()[]{}|", code)) return false;
+        if (code != '\\') {
+            text += code;
+            continue;
+        }
+        if (++at == pattern.size()) return false;
+        const char escaped = pattern[at];
+        switch (escaped) {
+        case 'n': text += '\n'; break;
+        case 'r': text += '\r'; break;
+        case 't': text += '\t'; break;
+        case 'f': text += '\f'; break;
+        case 'v': text += '\v'; break;
+        default:
+            // classes, backreferences and the like
+            if (std::isalnum(uchar(escaped))) return false;
+            text += escaped;
+        }
+    }
+    return !text.empty();
+}
+
+
+Scanner::Match Literals::scan(const char* begin, const char* end,
+                              Priority priority) const {
+    Scanner::Match best;
+    if (empty()) return best;
+
+    uint32_t node = 0;
+    best.truncated = true;
+    for (const char* current = begin; current != end; ++current) {
+        const uint8_t code = uchar(*current);
+        if (node == 0) {
+            node = _root[code];
+        } else {
+            const Node& from = _nodes[node];
+            const uint8_t* first = _bytes.data() + from.begin;
+            const uint8_t* last = _bytes.data() + from.end;
+            const uint8_t* found = std::lower_bound(first, last, code);
+            node = found != last && *found == code
+                 ? _targets[found - _bytes.data()] : 0;
+        }
+        if (node == 0) {
+            best.truncated = false;
+            break;
+        }
+
+        const Node& reached = _nodes[node];
+        if (reached.accept != Scanner::none &&
+            (priority == Priority::Longest || reached.accept < best.pattern)) {
+            best.pattern = reached.accept;
+            best.length = static_cast<uint64_t>(current + 1 - begin);
+        }
+        if (reached.begin == reached.end) {
+            best.truncated = false;
+            break;
+        }
+    }
+    return best;
+}
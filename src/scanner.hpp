@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+
+#include "simd.hpp"
+
+namespace parselib {
+
+enum class Priority {
+    First,      // the earliest rule that matches wins, as std::regex did
+    Longest     // the longest rule match wins, ties go to the earliest
+};
+
+
+/*
+ * Deterministic automaton compiled from a list of regular expressions. It
+ * understands the ECMAScript subset used by lexer rules: literals, escapes,
+ * classes, '.', groups, alternation and greedy quantifiers. Each pattern
+ * matches what std::regex would, trying alternatives left to right and
+ * quantifiers greedily, so "a|ab" matches "a" of "abc" rather than the
+ * longest prefix. Anchors, lookarounds, backreferences and lazy
+ * quantifiers are rejected and left to std::regex.
+ *
+ * States that loop on themselves over whitespace, digits or word characters
+ * consume such runs with the vectorized scanners from simd.hpp.
+ */
+class Scanner {
+public:
+    static constexpr uint32_t none = UINT32_MAX;
+
+    struct Match {
+        uint32_t pattern = none;
+        uint64_t length = 0;
+        // the automaton was still running when the input ran out
+        bool truncated = false;
+
+        bool empty() const { return pattern == none; }
+    };
+
+    // The automaton as plain data, for parselib_lexgen to emit as source
+    struct Tables {
+        std::vector<int32_t> next;          // by state and byte class
+        std::vector<uint32_t> accept;       // by state
+        std::vector<uint8_t> runs;          // simd::Run by state
+        std::vector<uint8_t> supported;     // by pattern
+        std::array<uint8_t, 256> classes{};
+        uint32_t columns = 0;
+    };
+
+private:
+    std::vector<int32_t> _next;
+    std::vector<uint32_t> _accept;
+    std::vector<simd::Run> _runs;
+    std::vector<bool> _supported;
+    uint8_t _class[256] = {};
+    uint32_t _classes = 0;
+
+public:
+    Scanner() = default;
+    // patterns marked in `skip` are left out as if they were unsupported
+    explicit Scanner(const std::vector<std::string>& patterns,
+                     const std::vector<bool>& skip={});
+
+    // an automaton compiled earlier, loaded without compiling anything
+    explicit Scanner(const Tables&);
+
+    Match scan(const char* begin, const char* end, Priority) const;
+    Tables tables() const;
+
+    bool supports(size_t pattern) const;
+    bool empty() const { return _accept.empty(); }
+    size_t states() const { return _accept.size(); }
+};
+
+
+
+/*
+ * Trie of the patterns that are fixed strings once unescaped. A single
+ * walk finds the longest literal at a position, or the earliest one by
+ * pattern index, so a large keyword and operator set costs one lookup
+ * instead of a try per rule. The root fans out through a full table,
+ * deeper nodes through their sorted edges.
+ */
+class Literals {
+    struct Node {
+        uint32_t begin = 0;         // edges [begin, end)
+        uint32_t end = 0;
+        uint32_t accept = Scanner::none;
+    };
+
+    std::vector<Node> _nodes;
+    std::vector<uint8_t> _bytes;
+    std::vector<uint32_t> _targets;
+    std::array<uint32_t, 256> _root{};      // 0 - no edge
+    std::vector<bool> _patterns;
+
+public:
+    Literals() = default;
+    // pattern indices with their literal text
+    explicit Literals(const std::vector<std::pair<uint32_t, std::string>>&);
+
+    // The text `pattern` matches if it is made of plain characters and
+    // escaped punctuation only, false for anything std::regex would treat
+    // as an operator
+    static bool literal(const std::string& pattern, std::string& text);
+
+    Scanner::Match scan(const char* begin, const char* end, Priority) const;
+
+    bool contains(size_t pattern) const {
+        return pattern < _patterns.size() && _patterns[pattern];
+    }
+    bool empty() const { return _nodes.size() <= 1; }
+};
+
+}
@@ -0,0 +1,133 @@
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PARSELIB_SIMD_WIDTH 32
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PARSELIB_SIMD_WIDTH 16
+#endif
+
+#include "simd.hpp"
+
+using namespace parselib;
+
+
+
+namespace {
+
+inline bool inside(simd::Run run, unsigned char code) {
+    const bool digit = static_cast<unsigned char>(code - '0') < 10;
+    switch (run) {
+    case simd::Run::Spaces:
+        return code == ' ' || static_cast<unsigned char>(code - '\t') < 5;
+    case simd::Run::Digits:
+        return digit;
+    case simd::Run::Word:
+        return digit || code == '_' ||
+               static_cast<unsigned char>((code | 0x20) - 'a') < 26;
+    default:
+        return false;
+    }
+}
+
+
+#if defined(__AVX2__)
+
+using Vector = __m256i;
+
+inline Vector load(const char* at) {
+    return _mm256_loadu_si256(reinterpret_cast<const Vector*>(at));
+}
+inline Vector splat(char code) { return _mm256_set1_epi8(code); }
+inline Vector sub(Vector lhs, Vector rhs) {
+    return _mm256_sub_epi8(lhs, rhs);
+}
+inline Vector eq(Vector lhs, Vector rhs) {
+    return _mm256_cmpeq_epi8(lhs, rhs);
+}
+inline Vector either(Vector lhs, Vector rhs) {
+    return _mm256_or_si256(lhs, rhs);
+}
+inline Vector below(Vector value, char bound) {
+    // unsigned value < bound
+    const Vector limit = splat(static_cast<char>(bound - 1));
+    return eq(_mm256_min_epu8(value, limit), value);
+}
+inline uint32_t mask(Vector value) {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(value));
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+using Vector = __m128i;
+
+inline Vector load(const char* at) {
+    return _mm_loadu_si128(reinterpret_cast<const Vector*>(at));
+}
+inline Vector splat(char code) { return _mm_set1_epi8(code); }
+inline Vector sub(Vector lhs, Vector rhs) { return _mm_sub_epi8(lhs, rhs); }
+inline Vector eq(Vector lhs, Vector rhs) { return _mm_cmpeq_epi8(lhs, rhs); }
+inline Vector either(Vector lhs, Vector rhs) { return _mm_or_si128(lhs, rhs); }
+inline Vector below(Vector value, char bound) {
+    const Vector limit = splat(static_cast<char>(bound - 1));
+    return eq(_mm_min_epu8(value, limit), value);
+}
+inline uint32_t mask(Vector value) {
+    return static_cast<uint32_t>(_mm_movemask_epi8(value)) & 0xFFFF;
+}
+
+#endif
+
+
+#ifdef PARSELIB_SIMD_WIDTH
+
+inline Vector classify(simd::Run run, Vector bytes) {
+    const Vector digit = below(sub(bytes, splat('0')), 10);
+    switch (run) {
+    case simd::Run::Spaces:
+        return either(eq(bytes, splat(' ')),
+                      below(sub(bytes, splat('\t')), 5));
+    case simd::Run::Digits:
+        return digit;
+    default: {
+        const Vector lower = either(bytes, splat(0x20));
+        return either(either(digit, eq(bytes, splat('_'))),
+                      below(sub(lower, splat('a')), 26));
+    }
+    }
+}
+
+
+inline int first(uint32_t bits) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+#endif
+
+}
+
+
+
+const char* simd::skip(Run run, const char* begin, const char* end) {
+    if (run == Run::None) return begin;
+
+#ifdef PARSELIB_SIMD_WIDTH
+    const uint32_t full =
+        PARSELIB_SIMD_WIDTH == 32 ? 0xFFFFFFFFu : 0xFFFFu;
+    while (end - begin >= PARSELIB_SIMD_WIDTH) {
+        const uint32_t bits = mask(classify(run, load(begin)));
+        if (bits != full) return begin + first(~bits & full);
+        begin += PARSELIB_SIMD_WIDTH;
+    }
+#endif
+
+    while (begin != end && inside(run, static_cast<unsigned char>(*begin))) {
+        ++begin;
+    }
+    return begin;
+}
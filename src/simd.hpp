@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+namespace parselib { namespace simd {
+
+// Character classes a scanner state can loop over in bulk.
+enum class Run : uint8_t {
+    None,
+    Spaces,     // [ \t\n\v\f\r]
+    Digits,     // [0-9]
+    Word        // [A-Za-z0-9_]
+};
+
+// First position in [begin, end) whose byte is outside the class.
+const char* skip(Run, const char* begin, const char* end);
+
+}}
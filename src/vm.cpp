@@ -0,0 +1,311 @@
+#include <utility>
+#include <algorithm>
+
+#include "vm.hpp"
+#include "parsers.hpp"
+
+using namespace parselib;
+
+
+
+State Program::run(State state) const {
+    struct Frame {
+        uint32_t position;
+        TreeBuilder::Mark mark;
+        uint32_t node;
+        uint32_t reach;     // the enclosing node's, while this one is open
+        uint32_t rule;      // the Parser that entered it, 0 for none
+        bool choice = false;    // RETRY and FAIL return to its position
+    };
+
+    Context* context = state.context;
+    TreeBuilder& tree = context->tree;
+    FlatTree* flat = tree.flat();
+    const TokenStream& tokens = *context->tokens;
+    // the tokens lexed so far, more may come from a TokenSource
+    uint32_t end = tokens.size();
+    // Context::reach, kept in the context for the parsers and actions the
+    // program calls out to
+    uint32_t reach = context->reach;
+    const auto read = [&reach](uint32_t position) {
+        reach = std::max(reach, position + 1);
+    };
+
+    uint32_t position = state.position;
+    bool accept = state.accept;
+    std::vector<Frame> frames;
+    std::vector<uint32_t> returns;
+    // where each parser being memoized started, and the reach before it
+    std::vector<std::pair<uint32_t, uint32_t>> starts;
+
+    // Whether `position` is past the last token, pulling more from the
+    // source first. Calls out may have pulled already, leaving `end` low.
+    const auto ended = [&](uint32_t position) {
+        if (position < end) return false;
+        end = tokens.size();
+        if (position < end || !context->source) return position >= end;
+        if (context->window) {
+            // nothing before the oldest choice is read again, but for the
+            // token just matched, which actions may look at
+            uint32_t floor = position;
+            for (const Frame& frame : frames) {
+                if (frame.choice) {
+                    floor = frame.position;
+                    break;
+                }
+            }
+            context->floor = floor == 0 ? 0 : floor - 1;
+        }
+        context->source->pull(context->floor);
+        end = tokens.size();
+        return position >= end;
+    };
+
+    const auto apply = [&](const auto& parser) {
+        State current(context, position, accept);
+        context->reach = reach;
+        parser(current);
+        reach = context->reach;
+        position = current.position;
+        accept = current.accept;
+    };
+
+    for (size_t pc = 0;;) {
+        const Instruction& instruction = _code[pc++];
+        switch (instruction.op) {
+        case Op::MATCH:
+            accept = !ended(position) && tokens.tag(position) == instruction.a;
+            if (!accept) {
+                read(position);
+                context->expect(position, instruction.a);
+            }
+            position += accept;
+            probe::consume(accept);
+            break;
+        case Op::ANY:
+            accept = !ended(position);
+            if (!accept) { read(position); }
+            position += accept;
+            probe::consume(accept);
+            break;
+        case Op::JUMP:
+            pc = instruction.a;
+            break;
+        case Op::JEND:
+            if (ended(position)) { pc = instruction.a; }
+            break;
+        case Op::JACC:
+            if (accept) { pc = instruction.a; }
+            break;
+        case Op::JNOT:
+            if (!accept) { pc = instruction.a; }
+            break;
+        case Op::CHOICE:
+            frames.push_back({position, tree.mark(), none, 0, 0, true});
+            break;
+        case Op::RETRY:
+            tree.rollback(frames.back().mark);
+            position = frames.back().position;
+            break;
+        case Op::COMMIT:
+            frames.pop_back();
+            break;
+        case Op::FAIL:
+            tree.rollback(frames.back().mark);
+            position = frames.back().position;
+            accept = false;
+            frames.pop_back();
+            break;
+        case Op::ENTER: {
+            const TreeBuilder::Mark mark = tree.mark();
+            const bool open = flat && instruction.a != none;
+            const uint32_t node = open ? flat->open(instruction.a, position,
+                                                    instruction.b)
+                                       : none;
+            frames.push_back({
+                position, mark, node,
+                open ? std::exchange(reach, position) : 0, instruction.b
+            });
+            if (instruction.b != 0) { probe::enter(instruction.b); }
+            break;
+        }
+        case Op::EXIT: {
+            const Frame frame = frames.back();
+            frames.pop_back();
+            if (accept) {
+                if (frame.node != none) {
+                    flat->close(frame.node, position, reach);
+                }
+            } else {
+                if (frame.node != none) { flat->discard(frame.node); }
+                tree.rollback(frame.mark);
+            }
+            if (frame.node != none) { reach = std::max(reach, frame.reach); }
+            if (frame.rule != 0) { probe::exit(accept); }
+            break;
+        }
+        case Op::ACTION:
+            apply([&](State& current) { _actions[instruction.a](current); });
+            break;
+        case Op::HOOK: {
+            const uint32_t hook = accept ? instruction.a : instruction.b;
+            if (hook != none) {
+                apply([&](State& current) { _actions[hook](current); });
+            }
+            break;
+        }
+        case Op::RECALL: {
+            State current(context, position, accept);
+            context->reach = reach;
+            uint32_t outer = 0;
+            const bool hit = recall(instruction.a, current, outer);
+            reach = context->reach;
+            if (hit) {
+                position = current.position;
+                accept = current.accept;
+                pc = instruction.b;
+            } else {
+                starts.push_back({position, outer});
+            }
+            break;
+        }
+        case Op::REMEMBER:
+            context->reach = reach;
+            remember(instruction.a, State(context, starts.back().first),
+                     State(context, position, accept),
+                     starts.back().second);
+            reach = context->reach;
+            starts.pop_back();
+            break;
+        case Op::CALL:
+            returns.push_back(pc);
+            pc = _entries[instruction.a];
+            break;
+        case Op::RET:
+            pc = returns.back();
+            returns.pop_back();
+            break;
+        case Op::NATIVE:
+            apply([&](State& current) {
+                current = (*_natives[instruction.a])(current);
+            });
+            break;
+        case Op::JTAB: {
+            const std::vector<uint32_t>& targets = _jumps[instruction.a];
+            read(position);
+            const uint32_t tag = tokens.tag(position);
+            pc = tag + 1 < targets.size() ? targets[tag] : targets.back();
+            break;
+        }
+        case Op::MISS: {
+            const std::vector<uint32_t>& tags = _sets[instruction.a];
+            read(position);
+            if (!std::binary_search(tags.begin(), tags.end(),
+                                    tokens.tag(position))) {
+                pc = instruction.b;
+            }
+            break;
+        }
+        case Op::EXPECT:
+            for (const uint32_t tag : _sets[instruction.a]) {
+                context->expect(frames.back().position, tag);
+            }
+            break;
+        case Op::JSTAY:
+            if (position == frames.back().position) { pc = instruction.a; }
+            break;
+        case Op::ACCEPT:
+            accept = instruction.a;
+            break;
+        case Op::HALT:
+            context->reach = reach;
+            return State(context, position, accept);
+        }
+    }
+}
+
+
+std::ostream& parselib::operator << (std::ostream& os, const Program& program) {
+    static const char* names[] = {
+        "MATCH", "ANY", "JUMP", "JEND", "JACC", "JNOT", "CHOICE", "RETRY",
+        "COMMIT", "FAIL", "ENTER", "EXIT", "ACTION", "HOOK", "RECALL",
+        "REMEMBER", "CALL", "RET", "NATIVE", "JTAB", "MISS",
+        "EXPECT", "JSTAY", "ACCEPT", "HALT"
+    };
+    for (size_t pc = 0; pc < program.size(); ++pc) {
+        const Instruction& instruction = program.code()[pc];
+        os << pc << "\t" << names[size_t(instruction.op)] << "\t"
+           << instruction.a << "\t" << instruction.b << "\n";
+    }
+    return os;
+}
+
+
+
+Program Compiler::compile(const IParser& parser) {
+    Compiler compiler;
+    parser.compile(compiler);
+    compiler.emit(Op::HALT);
+    while (!compiler._pending.empty()) {
+        const auto [subroutine, body] = compiler._pending.back();
+        compiler._pending.pop_back();
+        compiler._program._entries[subroutine] = compiler.here();
+        body->compile(compiler);
+        compiler.emit(Op::RET);
+    }
+    return std::move(compiler._program);
+}
+
+
+size_t Compiler::emit(Op op, uint32_t a, uint32_t b) {
+    _program._code.push_back({op, a, b});
+    return _program._code.size() - 1;
+}
+
+
+void Compiler::patch(size_t at) {
+    Instruction& instruction = _program._code[at];
+    const bool second = instruction.op == Op::RECALL ||
+                        instruction.op == Op::MISS;
+    (second ? instruction.b : instruction.a) = here();
+}
+
+
+uint32_t Compiler::action(Action action) {
+    _program._actions.push_back(std::move(action));
+    return _program._actions.size() - 1;
+}
+
+
+void Compiler::native(const IParser& parser) {
+    _program._natives.emplace_back(parser.clone());
+    emit(Op::NATIVE, _program._natives.size() - 1);
+}
+
+
+void Compiler::call(const IParser& body) {
+    const auto [subroutine, fresh] =
+        _subroutines.try_emplace(&body, _program._entries.size());
+    if (fresh) {
+        _program._entries.push_back(0);
+        _pending.emplace_back(subroutine->second, &body);
+    }
+    emit(Op::CALL, subroutine->second);
+}
+
+
+uint32_t Compiler::jumps() {
+    _program._jumps.emplace_back();
+    return _program._jumps.size() - 1;
+}
+
+
+std::vector<uint32_t>& Compiler::jumps(uint32_t table) {
+    return _program._jumps[table];
+}
+
+
+uint32_t Compiler::set(std::vector<uint32_t> tags) {
+    _program._sets.push_back(std::move(tags));
+    return _program._sets.size() - 1;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <ostream>
+#include <functional>
+#include <unordered_map>
+
+namespace parselib {
+
+struct State;
+class IParser;
+using Action = std::function<void(State&)>;
+
+
+/*
+ * Instructions of the parsing machine. Its registers are the token position
+ * and the accept flag; backtrack frames, return addresses and packrat
+ * positions live on stacks in the heap, so nesting is not limited by the
+ * native stack. Operands are `a` and `b`.
+ */
+enum class Op : uint8_t {
+    MATCH,      // accept the next token if its tag is `a`
+    ANY,        // accept the next token
+    JUMP,       // go to `a`
+    JEND,       // go to `a` at the end of input
+    JACC,       // go to `a` if accepted
+    JNOT,       // go to `a` if not accepted
+    CHOICE,     // push a frame with the position and tree mark
+    RETRY,      // return to the top frame's position and tree
+    COMMIT,     // pop the top frame
+    FAIL,       // pop the top frame, return to it and reject
+    ENTER,      // push a frame, open a flat node of kind `a` for rule `b`
+    EXIT,       // pop the frame, close its node or roll back on rejection
+    ACTION,     // run action `a`
+    HOOK,       // run action `a` if accepted, action `b` otherwise
+    RECALL,     // replay parser `a` from the packrat table and go to `b`
+    REMEMBER,   // store the outcome of parser `a` in the packrat table
+    CALL,       // run subroutine `a`
+    RET,
+    NATIVE,     // run native parser `a`
+    JTAB,       // go to the entry of jump table `a` for the next tag
+    MISS,       // go to `b` unless the next tag is in set `a`
+    EXPECT,     // note set `a` as expected at the top frame's position
+    JSTAY,      // go to `a` if the position is the top frame's
+    ACCEPT,     // set the accept flag to `a`
+    HALT
+};
+
+
+struct Instruction {
+    Op op;
+    uint32_t a = 0;
+    uint32_t b = 0;
+};
+
+
+class Program {
+    friend class Compiler;
+
+    std::vector<Instruction> _code;
+    std::vector<uint32_t> _entries;     // first instruction per subroutine
+    std::vector<Action> _actions;
+    std::vector<std::shared_ptr<const IParser>> _natives;
+    // jump targets by tag, the last one for tags past the table
+    std::vector<std::vector<uint32_t>> _jumps;
+    std::vector<std::vector<uint32_t>> _sets;     // sorted tags
+
+public:
+    static constexpr uint32_t none = UINT32_MAX;
+
+    // Runs from `state` and returns what the compiled parser would
+    State run(State state) const;
+
+    bool empty() const { return _code.empty(); }
+    size_t size() const { return _code.size(); }
+    const std::vector<Instruction>& code() const { return _code; }
+};
+
+std::ostream& operator << (std::ostream&, const Program&);
+
+
+
+/*
+ * Lowers a parser to a Program through IParser::compile. Parsers the
+ * compiler can't see through, like Forward, run natively; Rec and Ref
+ * become subroutines compiled once each.
+ */
+class Compiler {
+    Program _program;
+    std::unordered_map<const IParser*, uint32_t> _subroutines;
+    std::vector<std::pair<uint32_t, const IParser*>> _pending;
+
+public:
+    static Program compile(const IParser&);
+
+    size_t here() const { return _program._code.size(); }
+    size_t emit(Op, uint32_t a=0, uint32_t b=0);
+    // points the jump at `at` to the next instruction
+    void patch(size_t at);
+
+    uint32_t action(Action);
+    void native(const IParser&);
+    // calls `body` as a subroutine
+    void call(const IParser& body);
+
+    uint32_t jumps();
+    std::vector<uint32_t>& jumps(uint32_t table);
+    uint32_t set(std::vector<uint32_t> tags);
+};
+
+}
@@ -1,5 +1,320 @@
+#include <regex>
+#include <cstring>
+#include <sstream>
 #include <gtest/gtest.h>
 
+#include "exceptions.hpp"
+#include "lexer.hpp"
+#include "calc.hpp"
+
+using namespace parselib;
+
+
 TEST(lexer, digits) {
-    ;
+    Lexer lexer({Rule{R"(\d+)", 1}, Rule{R"(\s+)", 2, true}});
+    Lexems result = lexer.tokenize("12 345\t6");
+    ASSERT_EQ(result.size(), 3);
+    EXPECT_EQ(result[1].content, "345");
+    EXPECT_EQ(result[1].start, 3);
+    EXPECT_EQ(result[1].end, 6);
+}
+
+
+TEST(rule, match_at) {
+    Rule digits{R"(\d+)", 1};
+    EXPECT_EQ(digits.matchAt("ab123c", 2), 3);
+    EXPECT_EQ(digits.matchAt("ab123c", 0), Rule::npos);
+    EXPECT_EQ(digits.matchAt("ab123c", 6), Rule::npos);
+
+    Rule twice{R"((\w)\1)", 2};
+    EXPECT_EQ(twice.scanner, nullptr);
+    EXPECT_EQ(twice.matchAt("xyy", 0), Rule::npos);
+    EXPECT_EQ(twice.matchAt("xyy", 1), 2);
+    EXPECT_TRUE(twice.match("xyy", 0).empty());
+
+    // the automaton finds the match std::regex would, not the longest
+    for (const char* pattern : {"a|ab", "=|==", "(ab)?(abcd)?", "(a?)*b"}) {
+        const Rule rule{pattern, 3};
+        for (const std::string input : {"abc", "==", "abcd", "aab"}) {
+            const MatchObject found = rule.match(input, 0);
+            EXPECT_EQ(rule.matchAt(input, 0),
+                      found.empty() || found.length(0) == 0
+                      ? Rule::npos : uint64_t(found.length(0)))
+                << pattern << " " << input;
+        }
+    }
+    EXPECT_NE(Rule("a|ab", 3).scanner, nullptr);
+    EXPECT_EQ(Rule("a|ab", 3).matchAt("abc", 0), 1);
+}
+
+
+TEST(simd, skip_runs) {
+    std::string input(100, ' ');
+    input += "\t\n 42x";
+    input += std::string(70, '7') + "abc_Z9-";
+    const char* begin = input.data();
+    const char* end = begin + input.size();
+
+    EXPECT_EQ(simd::skip(simd::Run::Spaces, begin, end) - begin, 103);
+    EXPECT_EQ(simd::skip(simd::Run::Digits, begin + 103, end) - begin, 105);
+    EXPECT_EQ(simd::skip(simd::Run::Digits, begin + 106, end) - begin, 176);
+    EXPECT_EQ(simd::skip(simd::Run::Word, begin + 105, end) - begin, 182);
+    EXPECT_EQ(simd::skip(simd::Run::None, begin, end), begin);
+    EXPECT_EQ(simd::skip(simd::Run::Spaces, end, end), end);
+}
+
+
+TEST(scanner, compiles_common_shapes) {
+    Scanner scanner({R"(\d+)", "[A-Za-z_][A-Za-z0-9_]*", R"(\+)", "a{2,3}",
+                     "(?:ab|cd)*x", R"((\w)\1)", "^a"});
+    EXPECT_TRUE(scanner.supports(0));
+    EXPECT_TRUE(scanner.supports(4));
+    EXPECT_FALSE(scanner.supports(5));
+    EXPECT_FALSE(scanner.supports(6));
+
+    const std::string input = "abcdx";
+    Scanner::Match match = scanner.scan(input.data(),
+                                        input.data() + input.size(),
+                                        Priority::First);
+    EXPECT_EQ(match.pattern, 1);
+    EXPECT_EQ(match.length, 5);
+}
+
+
+TEST(scanner, literal_trie) {
+    std::string text;
+    EXPECT_TRUE(Literals::literal(R"(\+\+)", text));
+    EXPECT_EQ(text, "++");
+    EXPECT_TRUE(Literals::literal(R"(if\n)", text));
+    EXPECT_EQ(text, "if\n");
+    EXPECT_FALSE(Literals::literal(R"(\d)", text));
+    EXPECT_FALSE(Literals::literal("a|b", text));
+    EXPECT_FALSE(Literals::literal("", text));
+
+    const Literals literals({{0, "+"}, {1, "++"}, {2, "+="}, {3, "++"}});
+    EXPECT_FALSE(literals.contains(4));
+    const std::string input = "++=";
+    const char* end = input.data() + input.size();
+    Scanner::Match longest = literals.scan(input.data(), end,
+                                           Priority::Longest);
+    EXPECT_EQ(longest.pattern, 1);
+    EXPECT_EQ(longest.length, 2);
+    EXPECT_FALSE(longest.truncated);
+    Scanner::Match first = literals.scan(input.data(), end, Priority::First);
+    EXPECT_EQ(first.pattern, 0);
+    EXPECT_EQ(first.length, 1);
+    // "++" could still become a longer literal
+    EXPECT_TRUE(literals.scan(input.data(), input.data() + 1,
+                              Priority::Longest).truncated);
+}
+
+
+TEST(lexer, literals_beside_large_automaton) {
+    // too many keywords for one automaton, they go to the trie
+    enum { SPECIAL = 1, NAME, KEYWORD = 100 };
+    Rules rules{Rule{"kw5[0-9]x", SPECIAL}};
+    for (unsigned keyword = 0; keyword < 10000; ++keyword) {
+        rules.push_back(Rule{"kw" + std::to_string(keyword),
+                             KEYWORD + keyword});
+    }
+    rules.push_back(Rule{"[a-z]+[0-9]*", NAME});
+    rules.push_back(Rule{" ", 0, true});
+
+    const Lexer first(rules);
+    ASSERT_FALSE(first.literals().empty());
+    EXPECT_TRUE(first.scanner().supports(0));
+    Lexems lexems = first.tokenize("kw55x kw7 foo");
+    ASSERT_EQ(lexems.size(), 3);
+    EXPECT_EQ(lexems[0].tag, SPECIAL);
+    EXPECT_EQ(lexems[1].tag, KEYWORD + 7);
+    EXPECT_EQ(lexems[2].tag, NAME);
+
+    // ties go to the earlier rule, longer names win over keywords
+    lexems = Lexer(rules, Priority::Longest).tokenize("kw12 kw10000 kw55x");
+    ASSERT_EQ(lexems.size(), 3);
+    EXPECT_EQ(lexems[0].tag, KEYWORD + 12);
+    EXPECT_EQ(lexems[1].tag, NAME);
+    EXPECT_EQ(lexems[2].tag, SPECIAL);
+}
+
+
+TEST(lexer, generated_matches_runtime) {
+    // the rules of calc.lex, compiled by parselib_lexgen at build time
+    const Lexer runtime({
+        Rule{"let", calc::LET},
+        Rule{"[a-z_][a-z0-9_]*", calc::NAME},
+        Rule{R"(\d+)", calc::NUM},
+        Rule{R"(\+|-|\*|/|=)", calc::OP},
+        Rule{R"(\()", calc::OPEN},
+        Rule{R"(\))", calc::CLOSE},
+        Rule{R"((\$)\1)", calc::MARK},
+        Rule{R"(\s+)", 0, true}
+    });
+    const Lexer& generated = calc::lexer();
+    EXPECT_EQ(generated.scanner().states(), runtime.scanner().states());
+
+    const std::string input = "let x1 = (12 + y) * 3 $$ letter";
+    TokenStream expected, tokens;
+    runtime.tokenize(input, expected);
+    generated.tokenize(input, tokens);
+    // the earlier rule wins, so "letter" is "let" and "ter"
+    ASSERT_EQ(tokens.size(), 13);
+    ASSERT_EQ(tokens.size(), expected.size());
+    for (size_t index = 0; index < tokens.size(); ++index) {
+        EXPECT_EQ(tokens.tag(index), expected.tag(index));
+        EXPECT_EQ(tokens.content(index), expected.content(index));
+    }
+    EXPECT_EQ(tokens.tag(0), calc::LET);
+    EXPECT_EQ(tokens.tag(10), calc::MARK);
+    EXPECT_EQ(tokens.tag(11), calc::LET);
+}
+
+
+TEST(scanner, matches_like_regex) {
+    // alternatives are tried left to right and the first match stands
+    const std::vector<std::string> patterns = {
+        "a|ab", "=|==", "(ab)?(abcd)?", "(a|ab)(c|bcd)", "a{0,2}ab",
+        "(ab|a){0,2}b", "[ab]*b|c"
+    };
+    for (const std::string& pattern : patterns) {
+        Scanner scanner({pattern});
+        ASSERT_TRUE(scanner.supports(0)) << pattern;
+        const std::regex regex(pattern);
+        for (const char* input : {"abc", "==", "abcd", "abcdx", "aab",
+                                  "ababb", "bbb", "c"}) {
+            const char* end = input + std::strlen(input);
+            std::cmatch found;
+            const bool matched = std::regex_search(
+                input, end, found, regex,
+                std::regex_constants::match_continuous) && found.length(0);
+            const Scanner::Match match = scanner.scan(input, end,
+                                                      Priority::First);
+            EXPECT_EQ(match.empty(), !matched) << pattern << " " << input;
+            if (matched) {
+                EXPECT_EQ(match.length, found.length(0))
+                    << pattern << " " << input;
+            }
+        }
+    }
+
+    // repeats of what may match nothing are left to std::regex
+    Scanner nullable({"(a?)*b", "(a|b?)+", "(a*){2}"});
+    EXPECT_FALSE(nullable.supports(0));
+    EXPECT_FALSE(nullable.supports(1));
+    EXPECT_FALSE(nullable.supports(2));
+
+    Lexems result = Lexer({Rule{"a|ab", 1}, Rule{".", 2}}).tokenize("abc");
+    ASSERT_EQ(result.size(), 3);
+    EXPECT_EQ(result[0].content, "a");
+    EXPECT_EQ(result[0].tag, 1);
+    EXPECT_EQ(result[1].tag, 2);
+}
+
+
+TEST(lexer, first_rule_wins) {
+    Rules rules{Rule{"if", 1}, Rule{"[a-z]+", 2}, Rule{" ", 3, true}};
+    Lexems first = Lexer(rules).tokenize("if iffy");
+    ASSERT_EQ(first.size(), 3);
+    EXPECT_EQ(first[1].tag, 1);
+    EXPECT_EQ(first[2].content, "fy");
+
+    Lexems longest = Lexer(rules, Priority::Longest).tokenize("if iffy");
+    ASSERT_EQ(longest.size(), 2);
+    EXPECT_EQ(longest[0].tag, 1);
+    EXPECT_EQ(longest[1].tag, 2);
+    EXPECT_EQ(longest[1].content, "iffy");
+}
+
+
+TEST(lexer, regex_fallback) {
+    Rules rules{Rule{R"((\w)\1)", 1}, Rule{R"(\w)", 2}};
+    Lexems result = Lexer(rules).tokenize("aabcc");
+    ASSERT_EQ(result.size(), 3);
+    EXPECT_EQ(result[0].tag, 1);
+    EXPECT_EQ(result[1].tag, 2);
+    EXPECT_EQ(result[2].content, "cc");
+}
+
+
+TEST(lexer, unexpected) {
+    Lexer lexer({Rule{R"(\d+)", 1}});
+    EXPECT_THROW(lexer.tokenize("12a"), error::lexical::UnexpectedLexem);
+    try {
+        TokenStream tokens;
+        lexer.tokenize("12a", tokens);
+        FAIL();
+    } catch (const error::lexical::UnexpectedLexem& error) {
+        EXPECT_EQ(error.offset(), 2);
+    }
+}
+
+
+TEST(lexer, stream_across_chunks) {
+    Lexer lexer({Rule{R"(\d+)", 1}, Rule{"[a-z]+", 2},
+                 Rule{R"((\+)\1?)", 3}, Rule{R"(\s+)", 4, true}});
+    const std::string input = "123 abc ++ 4567  xy+z 89";
+    const Lexems expected = lexer.tokenize(input);
+
+    std::vector<std::string> chunks;
+    for (char symbol: input) { chunks.emplace_back(1, symbol); }
+    LexemStream stream = lexer.stream(chunks.begin(), chunks.end());
+    Lexems streamed(stream.begin(), stream.end());
+    ASSERT_EQ(streamed.size(), expected.size());
+    for (size_t index = 0; index < expected.size(); ++index) {
+        EXPECT_EQ(streamed[index].content, expected[index].content);
+        EXPECT_EQ(streamed[index].start, expected[index].start);
+        EXPECT_EQ(streamed[index].tag, expected[index].tag);
+    }
+
+    std::istringstream in(input);
+    LexemStream fromStream = lexer.stream(in);
+    Lexem lexem;
+    size_t count = 0;
+    while (fromStream.next(lexem)) { ++count; }
+    EXPECT_EQ(count, expected.size());
+}
+
+
+TEST(lexer, stream_bounded_memory) {
+    Lexer lexer({Rule{"[a-z]+", 1}, Rule{" ", 2, true}});
+    size_t produced = 0;
+    LexemStream stream = lexer.stream([&produced](std::string& buffer) {
+        if (produced++ == 10000) return false;
+        buffer += "alpha beta gamma ";
+        return true;
+    });
+
+    Lexem lexem;
+    size_t count = 0, peak = 0;
+    while (stream.next(lexem)) {
+        ++count;
+        peak = std::max(peak, stream.buffered());
+    }
+    EXPECT_EQ(count, 30000);
+    EXPECT_LT(peak, 64);
+}
+
+
+TEST(lexer, parallel_matches_sequential) {
+    Lexer lexer({Rule{R"("[^"]*")", 1}, Rule{R"(\d+)", 2},
+                 Rule{"[a-z]+", 3}, Rule{R"(\s+)", 4, true}});
+    std::string input;
+    for (int line = 0; input.size() < (6 << 20); ++line) {
+        input += "word " + std::to_string(line) + " \"quoted 42 text\"";
+        input += line % 7 == 0 ? "\n" : " ";
+    }
+
+    TokenStream sequential, parallel;
+    lexer.tokenize(input, sequential);
+    lexer.tokenize(input, parallel, 8);
+    ASSERT_EQ(parallel.size(), sequential.size());
+    for (size_t index = 0; index < sequential.size(); ++index) {
+        ASSERT_EQ(parallel.offset(index), sequential.offset(index));
+        ASSERT_EQ(parallel.length(index), sequential.length(index));
+        ASSERT_EQ(parallel.tag(index), sequential.tag(index));
+    }
+
+    input[input.find("word", input.size() / 2)] = '#';
+    EXPECT_THROW(lexer.tokenize(input, parallel, 8),
+                 error::lexical::UnexpectedLexem);
 }
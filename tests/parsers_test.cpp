@@ -0,0 +1,1139 @@
+#include <random>
+#include <sstream>
+#include <thread>
+#include <cctype>
+#include <algorithm>
+
+#include <pthread.h>
+#include <gtest/gtest.h>
+
+#include "lexer.hpp"
+#include "parsers.hpp"
+#include "exceptions.hpp"
+#include "batch.hpp"
+#include "document.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+enum Tags { NUM = 1, ADD, OPEN, CLOSE, SPACE, MUL, POW, BANG };
+
+Lexer lexer() {
+    return Lexer({
+        Rule{R"(\d+)", NUM},
+        Rule{R"(\+)", ADD},
+        Rule{R"(\()", OPEN},
+        Rule{R"(\))", CLOSE},
+        Rule{R"(\s+)", SPACE, true},
+        Rule{R"(\*)", MUL},
+        Rule{R"(\^)", POW},
+        Rule{R"(!)", BANG}
+    });
+}
+
+
+// Atom that counts how often it is tried
+class Probe final : public IParser {
+    Tag _tag;
+    size_t* _calls;
+
+public:
+    Probe() = default;
+    Probe(Tag tag, size_t* calls) : _tag(tag), _calls(calls) {}
+
+    State operator () (State state) const override {
+        ++*_calls;
+        return Atom(_tag)(state);
+    }
+    IParser* clone() const override { return new Probe(*this); }
+    bool is_valid() const override { return true; }
+};
+
+
+// Tree node that keeps count of live instances
+class Node final : public AST {
+public:
+    static inline int live = 0;
+    std::string text;
+    std::vector<AST*> children;
+
+    Node(const std::string& text="") : text(text) { ++live; }
+    ~Node() override { --live; }
+
+    void append(AST* child) override { children.push_back(child); }
+    void pop(AST* child) override { std::erase(children, child); }
+    void accept(Visitor*) const override {}
+};
+
+
+// Runs `function` on a thread with a stack of `bytes`
+template <typename Function>
+void with_stack(size_t bytes, Function function) {
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, bytes);
+    pthread_t thread;
+    const auto run = [](void* function) -> void* {
+        (*static_cast<Function*>(function))();
+        return nullptr;
+    };
+    ASSERT_EQ(pthread_create(&thread, &attributes, run, &function), 0);
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attributes);
+}
+
+
+// expr = term + '+' + expr | term, term = num | '(' + expr + ')'
+struct Expr {};
+struct Term {};
+
+inline auto grammar(Term) {
+    return Atom(NUM) | (Atom(OPEN) + Rec<Expr>() + Atom(CLOSE));
+}
+
+inline auto grammar(Expr) {
+    return (Rec<Term>() + Atom(ADD) + Rec<Expr>()) | Rec<Term>();
+}
+
+}
+
+
+TEST(token_stream, views_input) {
+    const std::string input = "12 + (3)";
+    TokenStream tokens;
+    lexer().tokenize(input, tokens);
+
+    ASSERT_EQ(tokens.size(), 5);
+    EXPECT_EQ(tokens.content(0), "12");
+    EXPECT_EQ(tokens.content(0).data(), input.data());
+    EXPECT_EQ(tokens.offset(4), 7);
+    EXPECT_EQ(tokens.tag(3), NUM);
+    EXPECT_EQ(tokens.begin()[2].content, "(");
+
+    TokenStream adapted(lexer().tokenize(input));
+    ASSERT_EQ(adapted.size(), 5);
+    EXPECT_EQ(adapted.offset(4), 7);
+    EXPECT_EQ(adapted.content(3), "3");
+}
+
+
+TEST(driver, token_stream) {
+    const std::string input = "1 + (2 + 3)";
+    TokenStream tokens;
+    lexer().tokenize(input, tokens);
+
+    Parser grammar = Atom(NUM) + Atom(ADD) + Atom(OPEN) + Atom(NUM) +
+                     Atom(ADD) + Atom(NUM) + Atom(CLOSE);
+    Driver driver(grammar);
+    EXPECT_TRUE(driver.accept(tokens));
+    EXPECT_TRUE(driver.accept(lexer().tokenize(input)));
+
+    lexer().tokenize("1 + (2 + 3", tokens);
+    EXPECT_FALSE(driver.accept(tokens));
+}
+
+
+TEST(driver, packrat) {
+    // expr = term + '+' + expr | term
+    // term = num | '(' + expr + ')'
+    size_t calls = 0;
+    Parser term;
+    Forward expr = Forward::Decl([&term](const Forward& self, const State& s) {
+        return ((term + Atom(ADD) + self) | term)(s);
+    });
+    term = Probe(NUM, &calls) | (Atom(OPEN) + expr + Atom(CLOSE));
+
+    std::string input = "1";
+    for (int depth = 0; depth < 12; ++depth) { input = "(" + input + ")"; }
+    TokenStream tokens;
+    lexer().tokenize(input, tokens);
+
+    Driver plain(expr);
+    EXPECT_TRUE(plain.accept(tokens));
+    const size_t exponential = calls;
+
+    calls = 0;
+    Driver memoized(expr);
+    memoized.packrat(1 << 20);
+    EXPECT_TRUE(memoized.accept(tokens));
+    EXPECT_LT(calls, tokens.size());
+    EXPECT_GT(exponential, 100 * calls);
+
+    lexer().tokenize("(" + input, tokens);
+    EXPECT_FALSE(memoized.accept(tokens));
+}
+
+
+TEST(driver, packrat_replays_reach) {
+    enum Kinds { ROOT, PLUS, BANGED };
+    // `sum` reads the token after "1 +" to find it is no number; the second
+    // alternative gets it from the packrat table
+    const Parser sum(Atom(NUM) + Optional(Atom(ADD) + Atom(NUM)));
+    const Parser plus = Parser(sum + Atom(ADD)).kind(PLUS);
+    const Parser banged = Parser(sum + Atom(BANG)).kind(BANGED);
+    const Parser root =
+        Parser(((sum + Atom(CLOSE)) | plus | banged) + Many(Any())).kind(ROOT);
+    Driver native(root), compiled(root);
+    native.packrat(1 << 20);
+    compiled.packrat(1 << 20).compile();
+
+    TokenStream before, after;
+    lexer().tokenize("1 + !", before);
+    lexer().tokenize("1 + 5 !", after);
+    for (Driver* driver : {&native, &compiled}) {
+        FlatTree old, reparsed, expected;
+        ASSERT_TRUE(driver->parse(before, old));
+        ASSERT_EQ(old.size(), 2);
+        EXPECT_EQ(old[1].kind, PLUS);
+        EXPECT_EQ(old[1].reach, 3);
+
+        // the `!` became "5 !", which `plus` depended on
+        ASSERT_TRUE(driver->parse(after, reparsed, Reuse(old, 2, 3, 2)));
+        ASSERT_TRUE(driver->parse(after, expected));
+        ASSERT_EQ(reparsed.size(), 2);
+        EXPECT_EQ(reparsed[1].kind, expected[1].kind);
+        EXPECT_EQ(reparsed[1].kind, BANGED);
+    }
+}
+
+
+TEST(driver, static_grammar) {
+    TokenStream tokens;
+    Driver driver(Rec<Expr>{});
+    driver.packrat(1 << 20);
+    for (const char* input : {"1", "1 + 2", "(1 + (2)) + 3", "((((4))))"}) {
+        lexer().tokenize(input, tokens);
+        EXPECT_TRUE(driver.accept(tokens)) << input;
+    }
+    for (const char* input : {"(1", "1 + (", ")", "(1 + 2))"}) {
+        lexer().tokenize(input, tokens);
+        EXPECT_FALSE(driver.accept(tokens)) << input;
+    }
+}
+
+
+TEST(driver, rollback) {
+    // (pair | num) + ')', pair = num + '+' + num
+    const Parser num = Parser(Atom(NUM))
+        .on_accept(primary_type_builder<Node>());
+    const Parser pair = Parser(num + Atom(ADD) + num)
+        .on_before(before_action<Node>)
+        .on_accept(accept_action)
+        .on_disaccept(disaccept_action);
+    Driver driver((pair | num) + Atom(CLOSE));
+
+    TokenStream tokens;
+    Node root;
+    lexer().tokenize("7 )", tokens);
+    ASSERT_TRUE(driver.accept(tokens, &root));
+    ASSERT_EQ(root.children.size(), 1);
+    EXPECT_EQ(static_cast<Node*>(root.children[0])->text, "7");
+    EXPECT_EQ(Node::live, 2);
+
+    Node other;
+    lexer().tokenize("7 7", tokens);
+    EXPECT_FALSE(driver.accept(tokens, &other));
+    EXPECT_TRUE(other.children.empty());
+    EXPECT_EQ(Node::live, 3);
+
+    delete root.children[0];
+}
+
+
+TEST(arena, releases_in_bulk) {
+    Arena arena(256);
+    std::vector<Node*> nodes;
+    for (int index = 0; index < 100; ++index) {
+        nodes.push_back(arena.make<Node>(std::to_string(index)));
+    }
+    double* wide = static_cast<double*>(arena.allocate(1024, alignof(double)));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(wide) % alignof(double), 0);
+    EXPECT_EQ(nodes[42]->text, "42");
+    EXPECT_EQ(Node::live, 100);
+
+    const size_t reserved = arena.reserved();
+    arena.release();
+    EXPECT_EQ(Node::live, 0);
+    EXPECT_EQ(arena.used(), 0);
+
+    for (int index = 0; index < 100; ++index) { arena.make<Node>(); }
+    EXPECT_EQ(arena.reserved(), reserved);
+    arena.release();
+}
+
+
+TEST(arena, reuses_oversized_blocks) {
+    Arena arena(4096);
+    for (int parse = 0; parse < 1000; ++parse) {
+        arena.make<Node>();
+        arena.allocate(10000);
+        arena.make<Node>();
+        arena.release();
+    }
+    EXPECT_LE(arena.reserved(), 2 * 4096 + 10000);
+
+    // over-aligned objects, in a block and on their own
+    struct alignas(256) Wide { char bytes[300]; };
+    for (int index = 0; index < 20; ++index) {
+        const auto address = reinterpret_cast<uintptr_t>(arena.make<Wide>());
+        EXPECT_EQ(address % 256, 0);
+    }
+    const auto alone = reinterpret_cast<uintptr_t>(arena.allocate(5000, 512));
+    EXPECT_EQ(alone % 512, 0);
+    arena.release();
+}
+
+
+TEST(driver, arena_pool) {
+    const Parser num = Parser(Atom(NUM))
+        .on_accept(primary_type_builder<Node>());
+    const Parser pair = Parser(num + Atom(ADD) + num)
+        .on_before(before_action<Node>)
+        .on_accept(accept_action);
+    Driver driver(pair | num);
+
+    ArenaPool pool;
+    TokenStream tokens;
+    for (const char* input : {"1 + 2", "3", "4 + 5"}) {
+        lexer().tokenize(input, tokens);
+        ArenaPool::Lease arena = pool.acquire();
+        SyntaxTree tree = driver.parse(tokens, *arena);
+        EXPECT_NE(tree.root(), nullptr) << input;
+    }
+    EXPECT_EQ(Node::live, 0);
+    EXPECT_EQ(pool.idle(), 1);
+}
+
+
+TEST(driver, flat_tree) {
+    enum Kinds { SUM, NUMBER, GROUP };
+
+    // sum = term + '+' + sum | term, term = num | '(' + sum + ')'
+    Parser sum;
+    const Forward rest = Forward::Decl([&](const Forward&, const State& s) {
+        return sum(s);
+    });
+    const Parser term = Parser(Atom(NUM)).kind(NUMBER) |
+        Parser(Atom(OPEN) + rest + Atom(CLOSE)).kind(GROUP);
+    sum = Parser((term + Atom(ADD) + rest) | term).kind(SUM);
+
+    TokenStream tokens;
+    lexer().tokenize("1 + (2 + 3)", tokens);
+    FlatTree tree;
+    Driver driver(sum);
+    ASSERT_TRUE(driver.parse(tokens, tree));
+
+    std::vector<uint32_t> kinds;
+    for (const FlatTree::Node& node : tree) { kinds.push_back(node.kind); }
+    EXPECT_EQ(kinds, std::vector<uint32_t>(
+        {SUM, NUMBER, SUM, GROUP, SUM, NUMBER, SUM, NUMBER}));
+    EXPECT_EQ(tree[3].begin, 2);
+    EXPECT_EQ(tree[3].end, 7);
+
+    std::vector<uint32_t> children;
+    for (const FlatTree::Node& child : tree.children(0)) {
+        children.push_back(tree.index(child));
+    }
+    EXPECT_EQ(children, std::vector<uint32_t>({1, 2}));
+
+    struct Depth {
+        int depth = 0;
+        int deepest = 0;
+        void enter(const FlatTree::Node&) {
+            deepest = std::max(deepest, ++depth);
+        }
+        void leave(const FlatTree::Node&) { --depth; }
+    } depth;
+    tree.visit(depth);
+    EXPECT_EQ(depth.deepest, 6);
+    EXPECT_EQ(depth.depth, 0);
+
+    lexer().tokenize("1 + (2 +", tokens);
+    EXPECT_FALSE(driver.parse(tokens, tree));
+    EXPECT_TRUE(tree.empty());
+
+    // payloads go to the open node, and nowhere outside of one
+    tree.payload(1);
+    const uint32_t node = tree.open(SUM, 0);
+    tree.payload(2);
+    tree.close(node, 1);
+    tree.payload(3);
+    ASSERT_EQ(tree.size(), 1);
+    EXPECT_EQ(tree[0].payload, 2);
+}
+
+
+TEST(driver, reports_farthest_failure) {
+    Driver native{Rec<Expr>()}, compiled{Rec<Expr>()};
+    compiled.compile();
+    Driver keywords{Choice(Atom(ADD), Atom(MUL), Atom(BANG))};
+    Driver dispatched = keywords;
+    dispatched.compile();
+
+    struct Case {
+        std::vector<Driver*> drivers;
+        std::string input;
+        uint64_t offset;
+        uint32_t token;
+        std::vector<Tag> expected;
+    };
+    const std::vector<Case> cases = {
+        // the missing operand after the last `+`
+        {{&native, &compiled}, "1 + (2 + )", 9, 5, {NUM, OPEN}},
+        // the grammar is done before the end
+        {{&native, &compiled}, "1 2", 2, 1, {ADD}},
+        {{&native, &compiled}, "(1", 2, 2, {ADD, CLOSE}},
+        // a choice expects what all of its alternatives start with
+        {{&keywords, &dispatched}, "1", 0, 0, {ADD, MUL, BANG}},
+    };
+    TokenStream tokens;
+    for (const Case& test : cases) {
+        lexer().tokenize(test.input, tokens);
+        for (Driver* driver : test.drivers) {
+            ASSERT_FALSE(driver->accept(tokens)) << test.input;
+            const Failure& failure = driver->failure();
+            EXPECT_EQ(failure.offset, test.offset) << test.input;
+            EXPECT_EQ(failure.token, test.token) << test.input;
+            EXPECT_EQ(failure.expected, test.expected) << test.input;
+        }
+    }
+
+    // the lexer reports where no rule matches instead of throwing
+    Failure failure;
+    EXPECT_FALSE(lexer().tokenize("1 + x", tokens, failure));
+    EXPECT_EQ(failure.offset, 4);
+    EXPECT_EQ(failure.token, 2);
+    EXPECT_EQ(tokens.size(), 2);
+}
+
+
+TEST(driver, lexes_on_demand) {
+    const Lexer rules = lexer();
+    Driver native{Rec<Expr>()}, compiled{Rec<Expr>()};
+    compiled.compile();
+
+    // same outcome as lexing up front
+    TokenStream tokens;
+    for (const char* input : {"1 + (2 + 3)", "1 + (2 + )", "(1", "1 2"}) {
+        rules.tokenize(input, tokens);
+        for (Driver* driver : {&native, &compiled}) {
+            const bool accept = driver->accept(tokens);
+            const Failure expected = driver->failure();
+            TokenSource source(rules, input);
+            ASSERT_EQ(driver->accept(source), accept) << input;
+            if (accept) continue;
+            EXPECT_EQ(driver->failure().offset, expected.offset) << input;
+            EXPECT_EQ(driver->failure().token, expected.token) << input;
+            EXPECT_EQ(driver->failure().expected, expected.expected);
+        }
+    }
+
+    // a rejected input is lexed only a little past where the parse stopped
+    std::string input = "1 1";
+    for (size_t index = 0; index < 100000; ++index) { input += " + 1"; }
+    for (Driver* driver : {&native, &compiled}) {
+        TokenSource source(rules, input);
+        EXPECT_FALSE(driver->accept(source));
+        EXPECT_EQ(driver->failure().offset, 2);
+        EXPECT_LE(source.tokens().size(), TokenSource::batch);
+    }
+
+    // a byte no rule matches fails the parse where it gets to it
+    for (Driver* driver : {&native, &compiled}) {
+        TokenSource source(rules, "1 + (2 + x)");
+        EXPECT_FALSE(driver->accept(source));
+        EXPECT_TRUE(source.failed());
+        EXPECT_EQ(driver->failure().offset, 9);
+        EXPECT_EQ(driver->failure().token, 5);
+        EXPECT_EQ(driver->failure().expected, std::vector<Tag>({CLOSE}));
+    }
+
+    enum Kinds { SUM, NUMBER };
+    Driver sum{Parser(SepBy(Parser(Atom(NUM)).kind(NUMBER), Atom(ADD)))
+                   .kind(SUM)};
+    sum.compile();
+    FlatTree eager, lazy;
+    rules.tokenize("1 + 2 + 3", tokens);
+    ASSERT_TRUE(sum.parse(tokens, eager));
+    TokenSource source(rules, "1 + 2 + 3");
+    ASSERT_TRUE(sum.parse(source, lazy));
+    ASSERT_EQ(lazy.size(), eager.size());
+    for (uint32_t index = 0; index < lazy.size(); ++index) {
+        EXPECT_EQ(lazy[index].kind, eager[index].kind);
+        EXPECT_EQ(lazy[index].end, eager[index].end);
+    }
+
+    // a compiled accept keeps only the tokens it may still read
+    input = "1";
+    for (size_t index = 1; index < 1000000; ++index) { input += "+1"; }
+    Driver many{Many(Atom(NUM) | Atom(ADD))};
+    many.compile();
+    TokenSource window(rules, input);
+    EXPECT_TRUE(many.accept(window));
+    EXPECT_EQ(window.tokens().size(), 1999999);
+    EXPECT_LE(window.tokens().size() - window.tokens().first(),
+              4 * TokenSource::batch);
+}
+
+
+TEST(act, typed_actions) {
+    struct Count {
+        int* calls;
+        void operator () (State&) const { ++*calls; }
+    };
+    int opened = 0, accepted = 0, failed = 0;
+    const auto num = Act(Atom(NUM)).on_accept(MakeLeaf<Node>());
+    const auto pair = Act(num + Atom(ADD) + num)
+        .on_before(OpenNode<Node>())
+        .on_accept(CloseNode())
+        .on_disaccept(Count{&failed});
+    const auto counted = Act(pair | num)
+        .on_before(Count{&opened})
+        .on_accept(Count{&accepted});
+
+    TokenStream tokens;
+    Node root;
+    Driver driver(counted + Atom(CLOSE));
+    lexer().tokenize("4 )", tokens);
+    ASSERT_TRUE(driver.accept(tokens, &root));
+    EXPECT_EQ(std::tuple(opened, accepted, failed), std::tuple(1, 1, 1));
+    ASSERT_EQ(root.children.size(), 1);
+    EXPECT_EQ(static_cast<Node*>(root.children[0])->text, "4");
+    delete root.children[0];
+    root.children.clear();
+
+    lexer().tokenize("4 + 5 )", tokens);
+    ASSERT_TRUE(driver.accept(tokens, &root));
+    ASSERT_EQ(root.children.size(), 1);
+    Node* sum = static_cast<Node*>(root.children[0]);
+    EXPECT_EQ(sum->children.size(), 2);
+    for (AST* child : sum->children) { delete child; }
+    delete sum;
+
+    // a failed Act rolls back what its hooks built, with no on_before too
+    struct Note {
+        void operator () (State& state) const {
+            state.tree().append(state.tree().make<Node>("failed"));
+        }
+    };
+    struct Seen {
+        Node* root;
+        size_t* children;
+        void operator () (State&) const { *children = root->children.size(); }
+    };
+    Node tree;
+    size_t children = 0;
+    const auto noted = Act(Atom(NUM) + Atom(ADD)).on_disaccept(Note{});
+    const auto seen = Act<decltype(noted)>(noted)
+        .on_disaccept(Seen{&tree, &children});
+    Driver native((seen | num) + Atom(CLOSE)), compiled = native;
+    compiled.compile();
+    lexer().tokenize("4 )", tokens);
+    for (Driver* driver : {&native, &compiled}) {
+        children = 1;
+        ASSERT_TRUE(driver->accept(tokens, &tree));
+        EXPECT_EQ(children, 0);
+        ASSERT_EQ(tree.children.size(), 1);
+        delete tree.children[0];
+        tree.children.clear();
+    }
+}
+
+
+TEST(vm, matches_native) {
+    enum Kinds { SUM, NUMBER, GROUP };
+    struct Count {
+        int* calls;
+        void operator () (State&) const { ++*calls; }
+    };
+    int calls = 0;
+
+    // sum = term + '+' + sum | term, term = num | '(' + sum + ')' | any
+    Parser sum;
+    const Parser term = Parser(Atom(NUM)).kind(NUMBER) |
+        Parser(Atom(OPEN) + Ref(sum) + Atom(CLOSE)).kind(GROUP) |
+        Act(Atom(ADD) + Any()).on_before(Count{&calls});
+    sum = Parser((term + Atom(ADD) + Ref(sum)) | term).kind(SUM);
+
+    Driver native(sum);
+    Driver compiled(sum);
+    compiled.compile();
+    EXPECT_GT(compiled.program().size(), 0);
+
+    // every input of up to six tokens
+    std::vector<std::string> inputs = {""};
+    for (size_t begin = 0, length = 0; length < 6; ++length) {
+        const size_t end = inputs.size();
+        for (size_t index = begin; index < end; ++index) {
+            for (char symbol : std::string("1+()")) {
+                inputs.push_back(inputs[index] + symbol);
+            }
+        }
+        begin = end;
+    }
+
+    TokenStream tokens;
+    FlatTree expected, actual;
+    for (size_t memo : {0, 1 << 16}) {
+        native.packrat(memo);
+        compiled.packrat(memo);
+        for (const std::string& input : inputs) {
+            lexer().tokenize(input, tokens);
+            calls = 0;
+            const bool accept = native.parse(tokens, expected);
+            const int native_calls = std::exchange(calls, 0);
+            ASSERT_EQ(compiled.parse(tokens, actual), accept) << input;
+            ASSERT_EQ(calls, native_calls) << input;
+            ASSERT_EQ(compiled.finish().position, native.finish().position);
+            ASSERT_EQ(compiled.finish().accept, native.finish().accept);
+            ASSERT_EQ(actual.size(), expected.size()) << input;
+            for (size_t node = 0; node < actual.size(); ++node) {
+                EXPECT_EQ(actual[node].kind, expected[node].kind);
+                EXPECT_EQ(actual[node].end, expected[node].end);
+            }
+        }
+    }
+}
+
+
+TEST(vm, deep_nesting) {
+    // expr = num | '(' + expr + ')'
+    Parser expr;
+    expr = Atom(NUM) | (Atom(OPEN) + Ref(expr) + Atom(CLOSE));
+
+    const size_t depth = 100000;
+    const std::string input =
+        std::string(depth, '(') + "1" + std::string(depth, ')');
+    TokenStream tokens;
+    lexer().tokenize(input, tokens);
+
+    Driver driver(expr);
+    driver.compile();
+    EXPECT_TRUE(driver.accept(tokens));
+    lexer().tokenize(input + ")", tokens);
+    EXPECT_FALSE(driver.accept(tokens));
+}
+
+
+TEST(operators, precedence_and_associativity) {
+    // opens a node named after the operator token
+    const Action open = [](State& state) {
+        const auto content = state.tokens().content(state.position - 1);
+        state.tree().open(state.tree().make<Node>(std::string(content)));
+    };
+    const std::function<std::string(const AST*)> print = [&](const AST* ast) {
+        const Node* node = static_cast<const Node*>(ast);
+        if (node->children.empty()) return node->text;
+        std::string text = "(" + node->text;
+        for (const AST* child : node->children) { text += " " + print(child); }
+        return text + ")";
+    };
+
+    Parser expr;
+    const Parser primary = Parser(Atom(NUM))
+        .on_accept(primary_type_builder<Node>()) |
+        (Atom(OPEN) + Ref(expr) + Atom(CLOSE));
+    expr = Operators(primary)
+        .infix(ADD, 1, Assoc::Left, open, accept_action)
+        .infix(MUL, 2, Assoc::Left, open, accept_action)
+        .infix(POW, 4, Assoc::Right, open, accept_action)
+        .prefix(ADD, 3, open, accept_action)
+        .postfix(BANG, 5, open, accept_action);
+    Driver driver(expr);
+
+    const std::vector<std::pair<std::string, std::string>> cases = {
+        {"1", "1"},
+        {"1 + 2 * 3 + 4", "(+ (+ 1 (* 2 3)) 4)"},
+        {"2 ^ 3 ^ 4 * 5", "(* (^ 2 (^ 3 4)) 5)"},
+        {"+1 * 2 ^ 3", "(* (+ 1) (^ 2 3))"},
+        {"3 ! ! * +2", "(* (! (! 3)) (+ 2))"},
+        {"(1 + 2) * 3", "(* (+ 1 2) 3)"},
+    };
+    TokenStream tokens;
+    for (const auto& [input, expected] : cases) {
+        Node root;
+        lexer().tokenize(input, tokens);
+        ASSERT_TRUE(driver.accept(tokens, &root)) << input;
+        ASSERT_EQ(root.children.size(), 1) << input;
+        EXPECT_EQ(print(root.children[0]), expected) << input;
+        std::function<void(AST*)> destroy = [&](AST* ast) {
+            for (AST* child : static_cast<Node*>(ast)->children) {
+                destroy(child);
+            }
+            delete ast;
+        };
+        destroy(root.children[0]);
+    }
+
+    Node root;
+    for (const char* input : {"1 +", "1 * (2 +)", "^ 1"}) {
+        lexer().tokenize(input, tokens);
+        EXPECT_FALSE(driver.accept(tokens, &root)) << input;
+        EXPECT_TRUE(root.children.empty()) << input;
+    }
+    EXPECT_EQ(Node::live, 1);
+}
+
+
+TEST(choice, matches_or) {
+    Parser ordered, dispatched;
+    const auto alternatives = [](const Parser& self) {
+        return std::tuple(Atom(NUM) + Atom(ADD) + Atom(NUM), Atom(NUM),
+                          Atom(OPEN) + Ref(self) + Atom(CLOSE),
+                          Any() + Atom(BANG));
+    };
+    const auto [sum, num, group, bang] = alternatives(ordered);
+    ordered = sum | num | group | bang;
+    dispatched = std::apply([](const auto& ... alternative) {
+        return Choice(alternative...);
+    }, alternatives(dispatched));
+
+    const First first = dispatched.first();
+    EXPECT_TRUE(first.any);
+    EXPECT_FALSE(first.empty);
+    EXPECT_EQ(first.tags, std::vector<Tag>({NUM, OPEN}));
+
+    Driver native(ordered), table(dispatched), compiled(dispatched);
+    compiled.compile();
+
+    std::vector<std::string> inputs = {""};
+    for (size_t begin = 0, length = 0; length < 5; ++length) {
+        const size_t end = inputs.size();
+        for (size_t index = begin; index < end; ++index) {
+            for (char symbol : std::string("1+()!")) {
+                inputs.push_back(inputs[index] + symbol);
+            }
+        }
+        begin = end;
+    }
+
+    TokenStream tokens;
+    for (const std::string& input : inputs) {
+        lexer().tokenize(input, tokens);
+        const bool accept = native.accept(tokens);
+        for (Driver* driver : {&table, &compiled}) {
+            ASSERT_EQ(driver->accept(tokens), accept) << input;
+            ASSERT_EQ(driver->finish().position, native.finish().position);
+            ASSERT_EQ(driver->finish().accept, native.finish().accept);
+        }
+    }
+}
+
+
+TEST(choice, skips_alternatives) {
+    struct Count {
+        int* calls;
+        void operator () (State&) const { ++*calls; }
+    };
+    int failed = 0;
+    std::vector<Parser> keywords;
+    for (Tag tag : {ADD, MUL, POW, BANG, OPEN, CLOSE}) {
+        keywords.push_back(Act(Atom(tag)).on_disaccept(Count{&failed}));
+    }
+    Driver driver{Choice(keywords)};
+
+    TokenStream tokens;
+    lexer().tokenize(")", tokens);
+    EXPECT_TRUE(driver.accept(tokens));
+    lexer().tokenize("1", tokens);
+    EXPECT_FALSE(driver.accept(tokens));
+    EXPECT_EQ(failed, 0);
+}
+
+
+TEST(repeat, matches_recursion) {
+    enum Kinds { LIST, NUMBER };
+    // list = num + '+' + list | num
+    Parser list;
+    list = (Atom(NUM) + Atom(ADD) + Ref(list)) | Atom(NUM);
+    const Parser number = Parser(Atom(NUM)).kind(NUMBER);
+    const Parser loop = Parser(Optional(Atom(OPEN)) +
+        SepBy(number, Atom(ADD)) + Many(Some(Atom(CLOSE)))).kind(LIST);
+
+    Driver recursive(list), native{SepBy(Atom(NUM), Atom(ADD))};
+    Driver tree(loop), compiled(loop);
+    compiled.compile();
+
+    std::vector<std::string> inputs = {""};
+    for (size_t begin = 0, length = 0; length < 6; ++length) {
+        const size_t end = inputs.size();
+        for (size_t index = begin; index < end; ++index) {
+            for (char symbol : std::string("1+()")) {
+                inputs.push_back(inputs[index] + symbol);
+            }
+        }
+        begin = end;
+    }
+
+    TokenStream tokens;
+    FlatTree expected, actual;
+    for (const std::string& input : inputs) {
+        lexer().tokenize(input, tokens);
+        // the recursion accepts a trailing '+' at the end of input
+        if (!input.ends_with('+')) {
+            ASSERT_EQ(native.accept(tokens), recursive.accept(tokens))
+                << input;
+            ASSERT_EQ(native.finish().position,
+                      recursive.finish().position);
+        }
+
+        const bool accept = tree.parse(tokens, expected);
+        ASSERT_EQ(compiled.parse(tokens, actual), accept) << input;
+        ASSERT_EQ(compiled.finish().position, tree.finish().position);
+        ASSERT_EQ(actual.size(), expected.size()) << input;
+        for (size_t node = 0; node < actual.size(); ++node) {
+            EXPECT_EQ(actual[node].kind, expected[node].kind);
+            EXPECT_EQ(actual[node].end, expected[node].end);
+        }
+    }
+}
+
+
+TEST(repeat, long_lists) {
+    enum Kinds { LIST, NUMBER };
+    const size_t length = 1000000;
+    std::string input = "1";
+    for (size_t index = 1; index < length; ++index) { input += "+1"; }
+    TokenStream tokens;
+    lexer().tokenize(input, tokens);
+
+    const Parser list =
+        Parser(SepBy(Parser(Atom(NUM)).kind(NUMBER), Atom(ADD))).kind(LIST);
+    Driver native(list), compiled(list);
+    compiled.compile();
+    for (Driver* driver : {&native, &compiled}) {
+        FlatTree tree;
+        // repetitions loop in place, so a small stack is enough
+        with_stack(256 << 10, [&] {
+            EXPECT_TRUE(driver->parse(tokens, tree));
+        });
+        ASSERT_EQ(tree.size(), length + 1);
+        size_t children = 0;
+        for (const FlatTree::Node& node : tree.children(0)) {
+            EXPECT_EQ(node.kind, NUMBER);
+            ++children;
+        }
+        EXPECT_EQ(children, length);
+    }
+
+    Driver many{Many(Atom(NUM) | Atom(ADD))};
+    EXPECT_TRUE(many.accept(tokens));
+    EXPECT_EQ(many.finish().position, tokens.size());
+}
+
+
+TEST(document, matches_full_parse) {
+    enum Kinds { ROOT, STATEMENT, LIST, NUMBER, GROUP };
+    // root = statement*, statement = list '!', list = item ('+' item)*,
+    // item = num | '(' list ')'
+    Parser list;
+    const Parser item = Parser(Atom(NUM)).kind(NUMBER) |
+        Parser(Atom(OPEN) + Ref(list) + Atom(CLOSE)).kind(GROUP);
+    list = Parser(SepBy(item, Atom(ADD))).kind(LIST);
+    const Parser root =
+        Parser(Many(Parser(list + Atom(BANG)).kind(STATEMENT))).kind(ROOT);
+
+    const Lexer lexer = ::lexer();
+    Document document(lexer, root, "1+2! (3+4)+5! 6!");
+    EXPECT_TRUE(document.accept());
+    Driver driver(root);
+    TokenStream tokens;
+    FlatTree expected;
+
+    const auto edit = [&](size_t offset, size_t removed,
+                          const std::string& inserted) {
+        const std::string before = document.text();
+        bool accept = document.accept();
+        try {
+            accept = document.edit(offset, removed, inserted);
+        } catch (const error::lexical::UnexpectedLexem&) {
+            // an edit that doesn't lex changes nothing
+            ASSERT_EQ(document.text(), before);
+        }
+        const std::string& text = document.text();
+        lexer.tokenize(text, tokens);
+        ASSERT_EQ(document.tokens().size(), tokens.size()) << text;
+        for (size_t index = 0; index < tokens.size(); ++index) {
+            ASSERT_EQ(document.tokens().offset(index), tokens.offset(index));
+            ASSERT_EQ(document.tokens().content(index),
+                      tokens.content(index));
+        }
+        ASSERT_EQ(driver.parse(tokens, expected), accept) << text;
+        if (!accept) return;
+
+        const FlatTree& actual = document.tree();
+        ASSERT_EQ(actual.size(), expected.size()) << text;
+        for (size_t node = 0; node < actual.size(); ++node) {
+            ASSERT_EQ(actual[node].kind, expected[node].kind) << text;
+            ASSERT_EQ(actual[node].begin, expected[node].begin) << text;
+            ASSERT_EQ(actual[node].end, expected[node].end) << text;
+            ASSERT_EQ(actual[node].parent, expected[node].parent) << text;
+            ASSERT_EQ(actual[node].next_sibling,
+                      expected[node].next_sibling) << text;
+        }
+    };
+
+    // edits that keep the text valid, and broken ones undone right away,
+    // some of which don't even lex
+    std::mt19937 random(7);
+    const std::vector<std::string> items = {"7", "(8)+", "(9+9)+", "5! "};
+    for (int step = 0; step < 3000 && !HasFatalFailure(); ++step) {
+        const std::string text = document.text();
+        const size_t offset = random() % (text.length() + 1);
+        const std::string& item = items[random() % items.size()];
+        const char next = offset < text.length() ? text[offset] : 0;
+        const char last = offset > 0 ? text[offset - 1] : '!';
+        bool valid = std::isdigit(next);
+        if (item == "5! ") {
+            valid = last == '!';
+        } else if (item != "7") {
+            valid = (valid || next == '(') && !std::isdigit(last);
+        }
+        if (valid) {
+            edit(offset, 0, item);
+        } else if (offset == text.length() || text[offset] != ' ') {
+            const size_t removed = random() % 3;
+            std::string inserted(random() % 3, ' ');
+            for (char& symbol : inserted) { symbol = "12 +()!@"[random() % 8]; }
+            edit(offset, removed, inserted);
+            if (document.text() != text) {
+                edit(offset, inserted.length(), text.substr(offset, removed));
+            }
+        } else {
+            edit(offset, 0, " ");
+        }
+        ASSERT_TRUE(document.accept()) << document.text();
+    }
+}
+
+
+TEST(document, reparses_only_the_edit) {
+    enum Kinds { ROOT, STATEMENT, NUMBER };
+    int parsed = 0;
+    const Parser statement = Parser(
+        SepBy(Parser(Atom(NUM)).kind(NUMBER), Atom(ADD)) + Atom(BANG))
+        .kind(STATEMENT).on_accept([&parsed](State&) { ++parsed; });
+    const Parser root = Parser(Many(statement)).kind(ROOT);
+
+    std::string text;
+    for (int line = 0; line < 10000; ++line) { text += "1+22+333!\n"; }
+    const Lexer lexer = ::lexer();
+    Document document(lexer, root, text);
+    EXPECT_TRUE(document.accept());
+    EXPECT_EQ(parsed, 10000);
+
+    // the statement before the edit is parsed again as well
+    parsed = 0;
+    EXPECT_TRUE(document.edit(50001, 0, "4"));
+    EXPECT_LE(parsed, 2);
+    EXPECT_EQ(document.damage().count, 2);
+    EXPECT_EQ(document.tree()[0].end, 60000);
+
+    // the damage carries over edits that don't parse
+    parsed = 0;
+    EXPECT_FALSE(document.edit(50001, 1, "+"));
+    EXPECT_TRUE(document.edit(50001, 1, "5"));
+    EXPECT_LE(parsed, 6);
+    EXPECT_EQ(document.text().substr(50000, 4), "15+2");
+
+    // nor does an edit that doesn't lex, even one that grows the text
+    const std::string grown(100000, '@');
+    EXPECT_THROW(document.edit(50001, 0, grown),
+                 error::lexical::UnexpectedLexem);
+    EXPECT_EQ(document.text().length(), 100001);
+    EXPECT_TRUE(document.edit(50001, 1, "6"));
+    EXPECT_EQ(document.tokens().content(30000), "16");
+    EXPECT_EQ(document.tokens().offset(59999), 99999);
+}
+
+
+TEST(threads, shared_lexer_and_driver) {
+    enum Kinds { SUM, NUMBER, GROUP };
+    // sum = term ('+' term)*, term = num | '(' sum ')'
+    Parser sum;
+    const Choice term(Parser(Atom(NUM)).kind(NUMBER),
+                      Parser(Atom(OPEN) + Ref(sum) + Atom(CLOSE)).kind(GROUP));
+    sum = Parser(SepBy(term, Atom(ADD))).kind(SUM);
+
+    const Lexer lexer = ::lexer();
+    Driver native(sum);
+    Driver compiled(sum);
+    compiled.compile().packrat(1 << 16);
+
+    std::mt19937 random(11);
+    std::vector<std::string> inputs(256);
+    for (std::string& input : inputs) {
+        const size_t length = 1 + random() % 40;
+        for (size_t symbol = 0; symbol < length; ++symbol) {
+            input += "1+( )"[random() % 5];
+        }
+    }
+
+    // every thread parses every input, the first parses build the tables
+    // of the choice concurrently
+    struct Result {
+        bool accept = false;
+        size_t nodes = 0;
+        size_t lexems = 0;
+    };
+    const size_t count = 8;
+    std::vector<std::vector<Result>> results(count);
+    std::vector<std::thread> threads;
+    for (size_t thread = 0; thread < count; ++thread) {
+        threads.emplace_back([&, thread] {
+            Session session;
+            TokenStream tokens;
+            FlatTree tree;
+            for (size_t round = 0; round < 4; ++round) {
+                for (size_t index = 0; index < inputs.size(); ++index) {
+                    const size_t at = (index + thread * 31) % inputs.size();
+                    const Driver& driver = (at + round) % 2 ? native
+                                                            : compiled;
+                    lexer.tokenize(inputs[at], tokens);
+                    const Lexems lexems = lexer.tokenize(inputs[at]);
+                    Result result{driver.parse(session, tokens, tree),
+                                  tree.size(), lexems.size()};
+                    if (driver.accept(session, lexems) != result.accept) {
+                        result.nodes = SIZE_MAX;
+                    }
+                    if (round == 0) {
+                        results[thread].push_back(result);
+                    } else if (results[thread][index].accept !=
+                               result.accept) {
+                        results[thread][index].nodes = SIZE_MAX;
+                    }
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) { thread.join(); }
+
+    TokenStream tokens;
+    FlatTree tree;
+    for (size_t thread = 0; thread < count; ++thread) {
+        for (size_t index = 0; index < inputs.size(); ++index) {
+            const size_t at = (index + thread * 31) % inputs.size();
+            const Driver& driver = at % 2 ? native : compiled;
+            Session session;
+            lexer.tokenize(inputs[at], tokens);
+            const bool accept = driver.parse(session, tokens, tree);
+            const Result& result = results[thread][index];
+            ASSERT_EQ(result.accept, accept) << inputs[at];
+            ASSERT_EQ(result.nodes, tree.size()) << inputs[at];
+            ASSERT_EQ(result.lexems, tokens.size()) << inputs[at];
+        }
+    }
+}
+
+
+TEST(batch, matches_sequential_parses) {
+    enum Kinds { SUM, NUMBER, GROUP };
+    Parser sum;
+    const Parser term = Parser(Atom(NUM)).kind(NUMBER) |
+        Parser(Atom(OPEN) + Ref(sum) + Atom(CLOSE)).kind(GROUP);
+    sum = Parser(SepBy(term, Atom(ADD))).kind(SUM);
+    const Lexer lexer = ::lexer();
+    Driver driver(sum);
+    driver.compile();
+
+    // very uneven sizes, a few that don't parse and a few that don't lex
+    std::mt19937 random(5);
+    std::vector<std::string> inputs;
+    for (size_t index = 0; index < 500; ++index) {
+        std::string input = "1";
+        const size_t terms = index % 50 == 0 ? 20000 : random() % 20;
+        for (size_t term = 0; term < terms; ++term) {
+            input += random() % 4 ? " + 2" : " + (3 + 4)";
+        }
+        if (index % 7 == 0) { input += " )"; }
+        if (index % 11 == 0) { input += " a"; }
+        inputs.push_back(input);
+    }
+
+    const std::vector<Parsed> results = Batch(lexer, driver, 4).parse(inputs);
+    ASSERT_EQ(results.size(), inputs.size());
+    TokenStream tokens;
+    FlatTree tree;
+    for (size_t index = 0; index < inputs.size(); ++index) {
+        const Parsed& result = results[index];
+        if (index % 11 == 0) {
+            // lexing fails on the trailing `a` without throwing
+            EXPECT_FALSE(result.accept);
+            EXPECT_FALSE(result.error);
+            EXPECT_EQ(result.failure.offset, inputs[index].size() - 1);
+            continue;
+        }
+        ASSERT_FALSE(result.error);
+        lexer.tokenize(inputs[index], tokens);
+        ASSERT_EQ(result.tokens.size(), tokens.size());
+        EXPECT_EQ(result.tokens.source().data(), inputs[index].data());
+        ASSERT_EQ(result.accept, driver.parse(tokens, tree)) << index;
+        EXPECT_EQ(result.accept, index % 7 != 0);
+        EXPECT_EQ(result.position, driver.finish().position);
+        ASSERT_EQ(result.tree.size(), tree.size());
+        for (size_t node = 0; node < tree.size(); ++node) {
+            EXPECT_EQ(result.tree[node].kind, tree[node].kind);
+            EXPECT_EQ(result.tree[node].end, tree[node].end);
+        }
+    }
+}
+
+
+TEST(profile, counts_backtracking) {
+    if (!profiling) GTEST_SKIP() << "built without PARSELIB_PROFILE";
+
+    // expr = term '+' expr | term parses every term twice at the last one
+    Parser expr, term;
+    term = Parser(Atom(NUM)).name("term");
+    expr = Parser((term + Atom(ADD) + Ref(expr)) | term).name("expr");
+
+    Profile profile;
+    TokenStream tokens;
+    Driver driver(expr);
+    {
+        const Profile::Scope scope(profile);
+        lexer().tokenize("1 + 2 + 3", tokens);
+        EXPECT_TRUE(driver.accept(tokens));
+    }
+
+    EXPECT_EQ(profile.total(expr.id()).calls, 3);
+    EXPECT_EQ(profile.total(term.id()).calls, 4);
+    EXPECT_EQ(profile.total(term.id()).accepts, 4);
+    // the last expr took `3` and failed on the missing `+`, so the Or falls
+    // back to `3`; both Ands of the sequence count the token they gave up
+    Profile::Counters sequences, choices;
+    for (const Profile::Frame& frame : profile.frames()) {
+        sequences += frame.sequences;
+        choices += frame.choices;
+    }
+    EXPECT_EQ(choices.calls, 3);
+    EXPECT_EQ(choices.backtracks, 1);
+    EXPECT_EQ(choices.retried, 1);
+    EXPECT_EQ(sequences.retried, 2);
+
+    uint64_t numbers = 0, bytes = 0;
+    for (const auto& [key, rule] : profile.rules()) {
+        if (rule.name == R"(\d+)") { numbers = rule.hits; }
+        bytes += key.second == Profile::none ? 0 : rule.bytes;
+    }
+    EXPECT_EQ(numbers, 3);
+    EXPECT_EQ(bytes, 9);
+
+    std::ostringstream folded;
+    profile.folded(folded, Profile::Weight::Calls);
+    // recursion stays in one frame
+    EXPECT_NE(folded.str().find("root;expr;term 4\n"), std::string::npos)
+        << folded.str();
+
+    // the compiled grammar reports the same parser frames
+    Profile compiled;
+    driver.compile();
+    {
+        const Profile::Scope scope(compiled);
+        EXPECT_TRUE(driver.accept(tokens));
+    }
+    EXPECT_EQ(compiled.total(expr.id()).calls, 3);
+    EXPECT_EQ(compiled.total(term.id()).calls, 4);
+}
@@ -0,0 +1,256 @@
+/*
+ * Compiles a lexer specification to C++ at build time:
+ *
+ *     parselib_lexgen calc.lex calc.hpp calc.cpp calc
+ *
+ * The header declares the tags and `const parselib::Lexer& calc::lexer()`,
+ * the source holds the automaton tables, so the lexer is loaded on first
+ * use without compiling a std::regex for the rules the automaton holds.
+ *
+ * A specification has one rule per line, a tag name and the pattern after
+ * it; the rest of the line, trailing spaces aside, is the pattern. A name
+ * starting with '-' marks the rule ignorable. Tags are numbered from 1 in
+ * order of first use and may be shared by several rules. '#' starts a
+ * comment line and "%longest" switches to Priority::Longest:
+ *
+ *     %longest
+ *     NUM     \d+
+ *     ADD     \+|-
+ *     -SPACE  \s+
+ */
+#include <regex>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "lexer.hpp"
+
+using namespace parselib;
+
+
+namespace {
+
+struct Spec {
+    struct Line {
+        std::string name;
+        std::string pattern;
+        bool ignorable = false;
+        size_t number = 0;      // in the file
+    };
+
+    std::vector<Line> lines;
+    std::vector<std::string> tags;      // names in order of first use
+    Priority priority = Priority::First;
+};
+
+
+bool identifier(const std::string& name) {
+    if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) {
+        return false;
+    }
+    for (const char code: name) {
+        if (!std::isalnum(static_cast<unsigned char>(code)) && code != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+Spec read(std::istream& is, const std::string& path) {
+    Spec spec;
+    std::string text;
+    for (size_t number = 1; std::getline(is, text); ++number) {
+        while (!text.empty() && std::isspace(
+                   static_cast<unsigned char>(text.back()))) {
+            text.pop_back();
+        }
+        const size_t start = text.find_first_not_of(" \t");
+        if (start == std::string::npos || text[start] == '#') continue;
+        if (text.compare(start, std::string::npos, "%longest") == 0) {
+            spec.priority = Priority::Longest;
+            continue;
+        }
+
+        const size_t split = text.find_first_of(" \t", start);
+        const size_t pattern = split == std::string::npos
+                             ? split : text.find_first_not_of(" \t", split);
+        Spec::Line line;
+        line.name = text.substr(start, split - start);
+        line.ignorable = line.name[0] == '-';
+        if (line.ignorable) { line.name.erase(0, 1); }
+        if (!identifier(line.name) || pattern == std::string::npos) {
+            throw std::runtime_error(path + ":" + std::to_string(number) +
+                                     ": expected a tag name and a pattern");
+        }
+        line.pattern = text.substr(pattern);
+        line.number = number;
+        if (std::find(spec.tags.begin(), spec.tags.end(), line.name) ==
+            spec.tags.end()) {
+            spec.tags.push_back(line.name);
+        }
+        spec.lines.push_back(line);
+    }
+    return spec;
+}
+
+
+std::string quote(const std::string& text) {
+    std::ostringstream os;
+    os << '"';
+    for (const char code: text) {
+        const unsigned char byte = static_cast<unsigned char>(code);
+        if (code == '"' || code == '\\') {
+            os << '\\' << code;
+        } else if (std::isprint(byte)) {
+            os << code;
+        } else {
+            os << '\\' << std::oct << std::setw(3) << std::setfill('0')
+               << unsigned(byte) << std::dec;
+        }
+    }
+    os << '"';
+    return os.str();
+}
+
+
+template <typename T, typename Container>
+void array(std::ostream& os, const char* type, const char* name,
+           const Container& values) {
+    os << "const std::array<" << type << ", " << values.size() << "> "
+       << name << " = {";
+    size_t column = 80;
+    for (const T value: values) {
+        const std::string item = std::to_string(value) + ",";
+        if (column + item.size() + 1 > 76) {
+            os << "\n   ";
+            column = 3;
+        }
+        os << " " << item;
+        column += item.size() + 1;
+    }
+    os << "\n};\n\n";
+}
+
+
+void header(std::ostream& os, const Spec& spec, const std::string& source,
+            const std::string& ns) {
+    os << "// Generated by parselib_lexgen from " << source
+       << ", do not edit.\n"
+       << "#pragma once\n\n"
+       << "#include \"lexer.hpp\"\n\n"
+       << "namespace " << ns << " {\n\n"
+       << "enum Tags : parselib::Tag {\n";
+    for (size_t index = 0; index < spec.tags.size(); ++index) {
+        os << "    " << spec.tags[index] << " = " << index + 1 << ",\n";
+    }
+    os << "};\n\n"
+       << "// built from the precompiled tables on first use\n"
+       << "const parselib::Lexer& lexer();\n\n"
+       << "}\n";
+}
+
+
+void source(std::ostream& os, const Spec& spec, const Lexer& lexer,
+            const std::string& source, const std::string& include,
+            const std::string& ns) {
+    const Scanner::Tables tables = lexer.scanner().tables();
+    os << "// Generated by parselib_lexgen from " << source
+       << ", do not edit.\n"
+       << "#include <array>\n\n"
+       << "#include \"" << include << "\"\n\n"
+       << "namespace " << ns << " {\n\n"
+       << "namespace {\n\n";
+    array<int32_t>(os, "int32_t", "next", tables.next);
+    array<uint32_t>(os, "uint32_t", "accept", tables.accept);
+    array<unsigned>(os, "uint8_t", "runs", tables.runs);
+    array<unsigned>(os, "uint8_t", "supported", tables.supported);
+    array<unsigned>(os, "uint8_t", "classes", tables.classes);
+
+    os << "parselib::Scanner scanner() {\n"
+       << "    parselib::Scanner::Tables tables;\n"
+       << "    tables.next.assign(next.begin(), next.end());\n"
+       << "    tables.accept.assign(accept.begin(), accept.end());\n"
+       << "    tables.runs.assign(runs.begin(), runs.end());\n"
+       << "    tables.supported.assign(supported.begin(),\n"
+       << "                            supported.end());\n"
+       << "    tables.classes = classes;\n"
+       << "    tables.columns = " << tables.columns << ";\n"
+       << "    return parselib::Scanner(tables);\n"
+       << "}\n\n"
+       << "}\n\n\n";
+
+    os << "const parselib::Lexer& lexer() {\n"
+       << "    static const parselib::Lexer lexer(parselib::Rules{\n";
+    for (size_t index = 0; index < spec.lines.size(); ++index) {
+        const Spec::Line& line = spec.lines[index];
+        // rules neither the automaton nor the trie holds need their regex
+        const bool compiled = lexer.scanner().supports(index) ||
+                              lexer.literals().contains(index);
+        os << "        parselib::Rule"
+           << (compiled ? "::precompiled(" : "(") << quote(line.pattern)
+           << ", " << line.name << (line.ignorable ? ", true" : "")
+           << "),\n";
+    }
+    os << "    }, scanner(), parselib::Priority::"
+       << (spec.priority == Priority::First ? "First" : "Longest") << ");\n"
+       << "    return lexer;\n"
+       << "}\n\n"
+       << "}\n";
+}
+
+
+std::string filename(const std::string& path) {
+    const size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    if (argc != 5) {
+        std::cerr << "usage: " << argv[0]
+                  << " SPEC HEADER SOURCE NAMESPACE\n";
+        return EXIT_FAILURE;
+    }
+    const std::string path = argv[1];
+    try {
+        std::ifstream input(path);
+        if (!input) throw std::runtime_error("can't read " + path);
+        const Spec spec = read(input, path);
+        if (spec.lines.empty()) {
+            throw std::runtime_error(path + ": no rules");
+        }
+
+        // the rules compile here once, as the Lexer would at run time
+        Rules rules;
+        for (const Spec::Line& line: spec.lines) {
+            const auto tag = std::find(spec.tags.begin(), spec.tags.end(),
+                                       line.name) - spec.tags.begin() + 1;
+            try {
+                rules.push_back(Rule(line.pattern, tag, line.ignorable));
+            } catch (const std::regex_error& error) {
+                throw std::runtime_error(path + ":" +
+                                         std::to_string(line.number) + ": " +
+                                         error.what());
+            }
+        }
+        const Lexer lexer(rules, spec.priority);
+
+        std::ofstream hpp(argv[2]), cpp(argv[3]);
+        header(hpp, spec, filename(path), argv[4]);
+        source(cpp, spec, lexer, filename(path), filename(argv[2]),
+               argv[4]);
+        if (!hpp || !cpp) throw std::runtime_error("can't write the output");
+    } catch (const std::exception& error) {
+        std::cerr << error.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
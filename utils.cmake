@@ -0,0 +1,56 @@
+# Builds a static library from the sources of the calling directory, which
+# also becomes its public include directory:
+#
+#     create_library(TARGET parselib SOURCES a.cpp HEADERS a.hpp)
+function(create_library)
+    cmake_parse_arguments(LIBRARY "" "TARGET" "SOURCES;HEADERS" ${ARGN})
+    add_library(${LIBRARY_TARGET} STATIC
+        ${LIBRARY_SOURCES} ${LIBRARY_HEADERS}
+    )
+    target_include_directories(${LIBRARY_TARGET}
+        PUBLIC "${CMAKE_CURRENT_SOURCE_DIR}"
+    )
+    target_compile_features(${LIBRARY_TARGET} PUBLIC cxx_std_20)
+endfunction()
+
+# Builds a googletest executable linked with LIBS and registers it with
+# ctest:
+#
+#     create_test_executable(TARGET a_test SOURCES a.cpp LIBS parselib)
+function(create_test_executable)
+    cmake_parse_arguments(TEST "" "TARGET" "SOURCES;LIBS" ${ARGN})
+    add_executable(${TEST_TARGET} ${TEST_SOURCES})
+    target_link_libraries(${TEST_TARGET} ${TEST_LIBS}
+        GTest::gtest GTest::gtest_main
+    )
+    add_test(NAME ${TEST_TARGET} COMMAND ${TEST_TARGET})
+endfunction()
+
+# Generates a lexer from a rule specification at build time and builds it
+# into a static library:
+#
+#     create_lexer(TARGET calc_lexer SPEC calc.lex NAMESPACE calc)
+#
+# Linking TARGET provides "<spec name>.hpp" with the tags of the rules and
+# `const parselib::Lexer& calc::lexer()`. See tools/lexgen.cpp for the
+# specification format.
+function(create_lexer)
+    cmake_parse_arguments(LEXER "" "TARGET;SPEC;NAMESPACE" "" ${ARGN})
+    get_filename_component(spec "${LEXER_SPEC}" ABSOLUTE)
+    get_filename_component(name "${LEXER_SPEC}" NAME_WE)
+    set(output "${CMAKE_CURRENT_BINARY_DIR}/${LEXER_TARGET}")
+    set(header "${output}/${name}.hpp")
+    set(source "${output}/${name}.cpp")
+
+    file(MAKE_DIRECTORY "${output}")
+    add_custom_command(
+        OUTPUT "${header}" "${source}"
+        COMMAND parselib_lexgen "${spec}" "${header}" "${source}"
+                "${LEXER_NAMESPACE}"
+        DEPENDS parselib_lexgen "${spec}"
+        COMMENT "Generating lexer ${name} from ${LEXER_SPEC}"
+    )
+    add_library(${LEXER_TARGET} STATIC "${source}" "${header}")
+    target_include_directories(${LEXER_TARGET} PUBLIC "${output}")
+    target_link_libraries(${LEXER_TARGET} PUBLIC parselib)
+endfunction()